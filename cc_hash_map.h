@@ -0,0 +1,231 @@
+#pragma once
+
+#include "map_adt.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Sharded Concurrent Hash Map
+ * Keys are spread over SHARDS independent maps by the high bits of their hash, each behind its own reader-writer lock,
+ * so threads only contend when they hit the same shard and lookups of a shard run in parallel
+ * `Map` is the map every shard is made of (e.g. lp_hash_map or sc_hash_map), each shard resizes on its own
+ */
+template <typename K, typename V, typename Map, typename Hash = function<int(K)>, uint32 SHARDS = 16>
+class cc_hash_map : virtual public map_adt<K, V>, public static_map<cc_hash_map<K, V, Map, Hash, SHARDS>, K, V> {
+  private:
+    static_assert(SHARDS > 0 && (SHARDS & (SHARDS - 1)) == 0, "SHARDS must be a power of two");
+
+    /** Map of a shard and the lock guarding it, aligned so locks of different shards never share a cache line */
+    class alignas(64) shard {
+      public:
+        shared_mutex lock;
+        Map map;
+
+        template <typename... A> shard(A &&...args) : map(forward<A>(args)...) {}
+    };
+
+    /** Base 2 logarithm of a power of two */
+    constexpr static uint32 log2(uint32 n) {
+        return n <= 1 ? 0 : 1 + log2(n >> 1);
+    }
+
+    /** Amount of hash bits used to select a shard */
+    constexpr static const uint32 SHARD_BITS = log2(SHARDS);
+
+    /** Every shard, never moved once created */
+    vector<unique_ptr<shard>> shards;
+    /** Hash function, the same one the shards use to calculate indexes */
+    Hash hash_fn;
+
+    /**
+     * Shard a key belongs to
+     * The hash is spread first, the maps of the shards use its low bits so the high ones are left for this
+     */
+    template <typename L> inline shard &shard_of(const L &key) {
+        if constexpr (SHARDS == 1)
+            return *this->shards[0];
+
+        const uint64 hash = (uint64)(uint32)this->hash_fn(key) * 0x9E3779B97F4A7C15ull;
+        return *this->shards[hash >> (64 - SHARD_BITS)];
+    }
+
+  public:
+    /**
+     * Constructor that takes the hash function as a parameter
+     * Every shard gets an even part of `initial_size`, `map_args` are passed to each of them after the hash function
+     * (e.g. the second hash function of dh_hash_map)
+     */
+    template <typename... A>
+    cc_hash_map(uint32 initial_size, Hash hash_fn = Hash(), A... map_args) : hash_fn(hash_fn) {
+        if (is_empty_fn(this->hash_fn)) {
+            cerr << "hash_fn cannot be null." << endl;
+            exit(1);
+        }
+
+        for (uint32 i = 0; i < SHARDS; i++)
+            this->shards.push_back(make_unique<shard>(initial_size / SHARDS + 1, hash_fn, map_args...));
+    }
+
+    /** Deconstructor, shards are owned by the map */
+    ~cc_hash_map() {}
+
+    /** Get the value paired with the key */
+    V get(const K &key) {
+        return this->template get<K>(key);
+    }
+
+    /**
+     * Get the value paired with a lookup key, e.g. a string_view for string keys
+     * Both Hash and the shards have to accept an `L` (see is_lookup_key)
+     */
+    template <typename L> V get(const L &key) {
+        shard &owner = this->shard_of(key);
+        shared_lock<shared_mutex> lock(owner.lock);
+        return owner.map.get(key);
+    }
+
+    /** Insert a key-value pair */
+    V put(const K &key, V value) {
+        shard &owner = this->shard_of(key);
+        unique_lock<shared_mutex> lock(owner.lock);
+        return owner.map.put(key, value);
+    }
+
+    /** Remove a key-value pair by it's key */
+    V remove(const K &key) {
+        return this->template remove<K>(key);
+    }
+
+    /** Remove a key-value pair by a lookup key */
+    template <typename L> V remove(const L &key) {
+        shard &owner = this->shard_of(key);
+        unique_lock<shared_mutex> lock(owner.lock);
+        return owner.map.remove(key);
+    }
+
+    /**
+     * Get the current size of the map
+     * Shards are counted one after the other, concurrent writes can make it stale by the time it returns
+     */
+    uint32 size() {
+        uint32 size = 0;
+
+        for (unique_ptr<shard> &current : this->shards) {
+            shared_lock<shared_mutex> lock(current->lock);
+            size += current->map.size();
+        }
+
+        return size;
+    }
+
+    /** Whether the map is empty */
+    bool empty() {
+        return this->size() == 0;
+    }
+
+    /** Clear the map - clears every shard */
+    void clear() {
+        for (unique_ptr<shard> &current : this->shards) {
+            unique_lock<shared_mutex> lock(current->lock);
+            current->map.clear();
+        }
+    }
+
+    /** Rehash every shard for an even part of the new target size */
+    void rehash(uint32 size) {
+        for (unique_ptr<shard> &current : this->shards) {
+            unique_lock<shared_mutex> lock(current->lock);
+            current->map.rehash(size / SHARDS + 1);
+        }
+    }
+
+    /**
+     * Call `callback(key, value)` for every stored pair, one shard at a time holding its read lock
+     * Pairs written to other shards meanwhile may or may not be visited
+     * There are no iterators, they would have to keep a shard locked between increments
+     */
+    template <typename F> void for_each(F callback) {
+        for (unique_ptr<shard> &current : this->shards) {
+            shared_lock<shared_mutex> lock(current->lock);
+            current->map.for_each(callback);
+        }
+    }
+
+    /**
+     * Vector with all the stored keys
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<K> keys() {
+        vector<K> result;
+        result.reserve(this->size());
+
+        this->for_each([&result](const K &key, V) { result.push_back(key); });
+
+        return result;
+    }
+
+    /**
+     * Vector with all the stored values
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<V> values() {
+        vector<V> result;
+        result.reserve(this->size());
+
+        this->for_each([&result](const K &, V value) { result.push_back(value); });
+
+        return result;
+    }
+
+    /** Heap memory held by every shard added up, the shard objects themselves aren't included */
+    memory_stats heap_usage() {
+        memory_stats memory;
+
+        for (unique_ptr<shard> &current : this->shards) {
+            shared_lock<shared_mutex> lock(current->lock);
+            memory += current->map.heap_usage();
+        }
+
+        return memory;
+    }
+
+    /** Print information about the hash map */
+    void info(stringstream &out) {
+        uint32 total = 0, min_size = UINT32_MAX, max_size = 0;
+        uint64 key_bytes = 0;
+        memory_stats memory;
+
+        for (unique_ptr<shard> &current : this->shards) {
+            shared_lock<shared_mutex> lock(current->lock);
+            const uint32 shard_size = current->map.size();
+
+            total     += shard_size;
+            min_size   = min(min_size, shard_size);
+            max_size   = max(max_size, shard_size);
+            key_bytes += current->map.key_heap_usage();
+            memory    += current->map.heap_usage();
+        }
+
+        out << "[cc] map info:\n"
+            << "shards: " << SHARDS << "\n"
+            << "size: " << total << "\n"
+            << "shard sizes: " << min_size << " - " << max_size << "\n";
+
+        // The shard objects hold the map objects, their heap memory is what the shards report
+        memory.info(out, sizeof(*this) + SHARDS * sizeof(shard), total * (sizeof(K) + sizeof(V)), key_bytes);
+        out << endl;
+    }
+};
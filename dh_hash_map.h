@@ -1,6 +1,7 @@
 #pragma once
 
 #include "map_adt.h"
+#include "memory.h"
 
 #include <cstdlib>
 #include <functional>
@@ -14,126 +15,200 @@ using namespace std;
 /**
  * Double Hashing Hash Map
  */
-template <typename K, typename V> class dh_hash_map : virtual public map_adt<K, V> {
+template <typename K, typename V, typename Capacity = prime_capacity, typename Hash1 = function<int(K)>,
+          typename Hash2 = function<int(K)>, typename KeyEqual = equal_to<K>>
+class dh_hash_map : virtual public map_adt<K, V>,
+                    public static_map<dh_hash_map<K, V, Capacity, Hash1, Hash2, KeyEqual>, K, V> {
   private:
+    friend class static_map<dh_hash_map, K, V>;
+
     /**
-     * key-value pair node
+     * key-value pair slot
+     * Stored inline in the table, so probing never leaves its memory
      */
-    class hash_node {
+    class hash_slot {
       public:
         K key;
         V value;
-
-        hash_node(K key, V value) : key(key), value(value) {}
     };
 
+    friend class slot_iterator<dh_hash_map, hash_slot>;
+
+    /** Occupancy state of a slot, DELETED slots are tombstones that keep probe sequences going */
+    enum slot_state : uint8 { EMPTY, FULL, DELETED };
+
     /** Target load factor */
     constexpr static const double LOAD_FACTOR_THRESHOLD = 0.75;
 
+    /** Policy deciding the size of the table and how hashes are reduced to indexes */
+    Capacity capacity;
     /** Max size of the table */
     uint32 max_size;
     /** Size threshold at which the table should be rehashed */
     uint32 size_threshold;
-    /** Table where all the nodes reside */
-    vector<hash_node *> table;
+    /** Heap memory held by the map, every table is allocated through it */
+    memory_stats memory;
+    /** Table where all the slots reside */
+    tracked_vector<hash_slot> table;
+    /** Occupancy state of each slot, kept apart so probes only touch a byte per slot */
+    tracked_vector<uint8> states;
     /** Current size of the table */
     uint32 current_size = 0;
+    /** Amount of DELETED slots */
+    uint32 tombstones = 0;
     /** First hash function to calculate the initial index to insert the value at */
-    function<int(K)> hash_fn1;
+    Hash1 hash_fn1;
     /** Second hash function to calculate the step by which we insert the value at */
-    function<int(K)> hash_fn2;
+    Hash2 hash_fn2;
+    /** Key equality, compared on every probed candidate */
+    KeyEqual key_equal;
+
+    /** Whether keys can be looked up with an `L`, both hash functions have to accept it (see is_lookup_key) */
+    template <typename L>
+    constexpr static bool is_lookup =
+        is_lookup_key<K, L, Hash1, KeyEqual>::value && is_lookup_key<K, L, Hash2, KeyEqual>::value;
+
+    /**
+     * Find the index of the slot holding the key, or max_size if there's none
+     * Stops at the first empty slot, tombstones are skipped over
+     */
+    template <typename L> uint32 find(const L &key) {
+        return this->find(key, this->capacity.index(this->hash_fn1(key)));
+    }
+
+    /** Find starting from the home index of the key */
+    template <typename L> uint32 find(const L &key, uint32 index) {
+        const uint32 step = this->capacity.step(this->hash_fn2(key));
+        uint32 counter    = 0;
+
+        while (counter < this->max_size && this->states[index] != EMPTY) {
+            if (this->states[index] == FULL && this->key_equal(this->table[index].key, key))
+                return index;
+
+            counter++;
+            index = this->capacity.wrap(index + step);
+        }
+
+        return this->max_size;
+    }
+
+    /** Start loading the home slot of a key into cache, returns the hash get_prefetched resolves it with */
+    template <typename L> uint64 prefetch_slots(const L &key) {
+        const uint32 index = this->capacity.index(this->hash_fn1(key));
+        prefetch(&this->states[index]);
+        prefetch(&this->table[index]);
+        return index;
+    }
+
+    /** Get the value paired with a key whose slots were already prefetched */
+    template <typename L> V get_prefetched(const L &key, uint64 hash) {
+        const uint32 index = this->find(key, hash);
+        return index != this->max_size ? this->table[index].value : nullptr;
+    }
+
+    /** Whether a slot holds a key-value pair */
+    inline bool occupied(uint32 index) const {
+        return this->states[index] == FULL;
+    }
 
   public:
     /** Constructor that takes both hash functions as parameters */
-    dh_hash_map(uint32 initial_size, function<int(K)> hash_fn1, function<int(K)> hash_fn2)
-        : max_size(initial_size), size_threshold(initial_size * LOAD_FACTOR_THRESHOLD), table(initial_size, nullptr),
-          hash_fn1(hash_fn1), hash_fn2(hash_fn2) {
-        if (hash_fn1 == nullptr || hash_fn2 == nullptr) {
+    dh_hash_map(uint32 initial_size, Hash1 hash_fn1 = Hash1(), Hash2 hash_fn2 = Hash2())
+        : max_size(capacity.resize(initial_size)), size_threshold(max_size * LOAD_FACTOR_THRESHOLD),
+          table(max_size, &memory), states(max_size, EMPTY, &memory), hash_fn1(hash_fn1), hash_fn2(hash_fn2) {
+        if (is_empty_fn(this->hash_fn1) || is_empty_fn(this->hash_fn2)) {
             cerr << "hash_fns cannot be null." << endl;
             exit(1);
         }
     }
 
-    /** Deconstructor, frees allocated memory */
-    ~dh_hash_map() {
-        this->clear();
-    }
+    /** Deconstructor, slots are owned by the table */
+    ~dh_hash_map() {}
 
     /** Get the value paired with the key */
-    V get(K key) {
-        int index      = this->hash_fn1(key) % this->max_size;
-        const int step = this->hash_fn2(key);
-        uint32 counter = 0;
-
-        hash_node *node = this->table[index];
-
-        // Stop once we run through the entire table or find a match
-        while (counter <= this->max_size && (node != nullptr ? node->key != key : true)) {
-            counter++;
-            index = (index + step) % this->max_size;
-            node  = this->table[index];
-        }
+    V get(const K &key) {
+        return this->template get<K>(key);
+    }
 
-        return node != nullptr ? node->value : nullptr;
+    /** Get the value paired with a lookup key, e.g. a string_view for string keys (see is_lookup_key) */
+    template <typename L, enable_if_t<is_lookup<L>, int> = 0>
+    V get(const L &key) {
+        const uint32 index = this->find(key);
+        return index != this->max_size ? this->table[index].value : nullptr;
     }
 
     /** Insert a key-value pair */
-    V put(K key, V value) {
-        if (this->current_size >= this->size_threshold) {
+    V put(const K &key, V value) {
+        if (this->current_size + this->tombstones >= this->size_threshold) {
             cout << "[dh] passed load factor threshold, rehashing" << endl;
-            this->rehash(this->current_size * 2);
+            // Mostly tombstones -> clean them up in a table of the same size
+            this->rehash(this->current_size >= this->size_threshold / 2 ? this->current_size * 2 : this->max_size);
         }
 
-        int index      = this->hash_fn1(key) % this->max_size;
-        const int step = this->hash_fn2(key);
+        uint32 index      = this->capacity.index(this->hash_fn1(key));
+        const uint32 step = this->capacity.step(this->hash_fn2(key));
+        uint32 free_index = this->max_size;
+        uint32 counter    = 0;
 
-        hash_node *cursor_node = this->table[index];
+        // Stop once we find an empty slot or a match, remembering the first tombstone on the way
+        while (counter < this->max_size && this->states[index] != EMPTY
+               && (this->states[index] == DELETED || !this->key_equal(this->table[index].key, key))) {
+            if (this->states[index] == DELETED && free_index == this->max_size)
+                free_index = index;
 
-        // Stop once we find an empty node or a match
-        while (cursor_node != nullptr && cursor_node->key != key) {
-            index       = (index + step) % this->max_size;
-            cursor_node = this->table[index];
+            counter++;
+            index = this->capacity.wrap(index + step);
         }
 
-        // Found empty node
-        if (cursor_node == nullptr) {
-            this->table[index] = new hash_node(key, value);
-            this->current_size++;
-            return nullptr;
+        // Match -> override value
+        if (counter < this->max_size && this->states[index] == FULL) {
+            V previous_value         = this->table[index].value;
+            this->table[index].value = value;
+            return previous_value;
         }
 
-        // Match -> override value
-        V previous_value   = cursor_node->value;
-        cursor_node->value = value;
+        if (free_index != this->max_size) {
+            // Reuse the first tombstone
+            this->tombstones--;
+        } else if (counter < this->max_size) {
+            // Found empty slot
+            free_index = index;
+        } else {
+            cout << "[dh] probe sequence is full, rehashing" << endl;
+            this->rehash(this->max_size * 2);
+            return this->put(key, value);
+        }
 
-        return previous_value;
-    }
+        hash_slot &slot          = this->table[free_index];
+        slot.key                 = key;
+        slot.value               = value;
+        this->states[free_index] = FULL;
+        this->current_size++;
 
-    /** Remove a key-value pair by it's key */
-    V remove(K key) {
-        int index      = this->hash_fn1(key) % this->max_size;
-        const int step = this->hash_fn2(key);
-        uint32 counter = 0;
+        return nullptr;
+    }
 
-        hash_node *node = this->table[index];
+    /** Remove a key-value pair by it's key, leaving a tombstone behind */
+    V remove(const K &key) {
+        return this->template remove<K>(key);
+    }
 
-        // Stop once we run through the entire table or find a match
-        while (counter <= this->max_size && (node != nullptr ? node->key != key : true)) {
-            counter++;
-            index = (index + step) % this->max_size;
-            node  = this->table[index];
-        }
+    /** Remove a key-value pair by a lookup key */
+    template <typename L, enable_if_t<is_lookup<L>, int> = 0>
+    V remove(const L &key) {
+        const uint32 index = this->find(key);
 
         // No match
-        if (node == nullptr)
+        if (index == this->max_size)
             return nullptr;
 
-        // Match -> delete node
-        V value = node->value;
+        // Match -> tombstone
+        V value = this->table[index].value;
 
-        this->table[index] = nullptr;
-        delete node;
+        this->table[index]  = hash_slot();
+        this->states[index] = DELETED;
         this->current_size--;
+        this->tombstones++;
 
         return value;
     }
@@ -148,45 +223,56 @@ template <typename K, typename V> class dh_hash_map : virtual public map_adt<K,
         return this->current_size == 0;
     }
 
-    /** Clear the map - frees allocated memory */
+    /** Clear the map - resets every slot but keeps the table's capacity */
     void clear() {
         for (uint32 i = 0; i < this->max_size; i++) {
-            hash_node *node = this->table[i];
-            if (node == nullptr)
+            if (this->states[i] == EMPTY)
                 continue;
 
-            this->table[i] = nullptr;
-            delete node;
+            this->table[i]  = hash_slot();
+            this->states[i] = EMPTY;
         }
 
         this->current_size = 0;
+        this->tombstones   = 0;
     }
 
     /**
      * Rehash table for new target size
-     * If the size isn't a prime, the next prime is selected
+     * The size is rounded up by the capacity policy (next prime or power of two)
      * Very costly operation, can be avoided by choosing an appropriate initial size
      * Can also end up being recursive if there's integer overflow
      */
     void rehash(uint32 size) {
         // Move, don't copy
-        vector<hash_node *> nodes = move(this->table);
-
-        for (uint32 i = 0; i < this->max_size; i++) {
-            this->table[i] = nullptr;
-        }
+        tracked_vector<hash_slot> slots = move(this->table);
+        tracked_vector<uint8> states    = move(this->states);
 
         // Calculate new size and apply
-        const uint32 new_size = find_next_prime(size);
-        this->table.resize(new_size);
-        this->current_size   = 0;
-        this->max_size       = new_size;
-        this->size_threshold = new_size * LOAD_FACTOR_THRESHOLD;
+        const uint32 new_size = this->capacity.resize(size);
+        this->table           = tracked_vector<hash_slot>(new_size, &this->memory);
+        this->states          = tracked_vector<uint8>(new_size, EMPTY, &this->memory);
+        this->current_size    = 0;
+        this->tombstones      = 0;
+        this->max_size        = new_size;
+        this->size_threshold  = new_size * LOAD_FACTOR_THRESHOLD;
+
+        // Reinsert slots
+        for (uint32 i = 0; i < slots.size(); i++)
+            if (states[i] == FULL)
+                this->put(move(slots[i].key), slots[i].value);
+    }
 
-        // Reinsert nodes
-        for (hash_node *node : nodes)
-            if (node != nullptr)
-                this->put(node->key, node->value);
+    /** Read-only forward iterator over the stored pairs, invalidated by any put, remove or rehash */
+    typedef slot_iterator<dh_hash_map, hash_slot> iterator;
+
+    /** Iterator to the first stored pair, pairs are visited in table order */
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, this->max_size);
     }
 
     /**
@@ -195,10 +281,10 @@ template <typename K, typename V> class dh_hash_map : virtual public map_adt<K,
      */
     vector<K> keys() {
         vector<K> result;
+        result.reserve(this->current_size);
 
-        for (hash_node *node : this->table)
-            if (node != nullptr)
-                result.push_back(node->key);
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.key);
 
         return result;
     }
@@ -209,25 +295,28 @@ template <typename K, typename V> class dh_hash_map : virtual public map_adt<K,
      */
     vector<V> values() {
         vector<V> result;
+        result.reserve(this->current_size);
 
-        for (hash_node *node : this->table)
-            if (node != nullptr)
-                result.push_back(node->value);
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.value);
 
         return result;
     }
 
+    /** Heap memory held by the map */
+    const memory_stats &heap_usage() const {
+        return this->memory;
+    }
+
     /** Print information about the hash map */
     void info(stringstream &out) {
         out << "[dh] map info:\n"
-            << "max size: " << this->max_size << "\n"
+            << "max size: " << this->max_size << " (" << Capacity::name << ")\n"
             << "size: " << this->current_size << "\n"
-            << "load factor: " << (double)this->current_size / this->max_size << "\n"
-            << "size in memory: "
-            << sizeof(*this)
-                   + this->current_size
-                         * (sizeof(hash_node *) + sizeof(hash_node) + (is_pointer<V>::value ? sizeof(*(V){nullptr}) : 0))
-            << " B\n"
-            << endl;
+            << "tombstones: " << this->tombstones << "\n"
+            << "load factor: " << (double)this->current_size / this->max_size << "\n";
+
+        this->memory.info(out, sizeof(*this), this->current_size * (sizeof(K) + sizeof(V)), this->key_heap_usage());
+        out << endl;
     }
 };
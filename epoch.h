@@ -0,0 +1,180 @@
+#pragma once
+
+#include "user.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/** Max amount of threads that can be alive and using epochs at the same time */
+const uint32 EPOCH_MAX_THREADS = 128;
+
+/**
+ * Index of the calling thread among the threads using epochs
+ * Claimed the first time a thread asks for it and given back when the thread exits,
+ * so it's the only atomic read-modify-write a reader ever does
+ */
+inline uint32 epoch_thread_index() {
+    static atomic<bool> claimed[EPOCH_MAX_THREADS];
+
+    class slot_owner {
+      public:
+        uint32 index;
+
+        slot_owner() {
+            for (this->index = 0; this->index < EPOCH_MAX_THREADS; this->index++) {
+                bool expected = false;
+                if (claimed[this->index].compare_exchange_strong(expected, true))
+                    return;
+            }
+
+            cerr << "more than " << EPOCH_MAX_THREADS << " threads are using epochs." << endl;
+            exit(1);
+        }
+
+        ~slot_owner() {
+            claimed[this->index].store(false, memory_order_release);
+        }
+    };
+
+    static thread_local slot_owner owner;
+    return owner.index;
+}
+
+/**
+ * Epoch based memory reclamation
+ * Readers announce the global epoch while they're inside a critical section, writers retire what they unlinked
+ * tagged with the epoch they closed right after unlinking it
+ * A retired pointer is freed once every announced epoch is newer than its tag, no reader can reach it anymore then
+ */
+class epoch_manager {
+  private:
+    /** Epoch announced by a reader, 0 while it's outside a critical section */
+    class alignas(64) reader_slot {
+      public:
+        atomic<uint64> epoch{0};
+    };
+
+    /** Pointer waiting for the readers to move on before being freed, `owner` is passed along to its deleter */
+    class retired_ptr {
+      public:
+        void *ptr;
+        void (*deleter)(void *, void *);
+        void *owner;
+        uint64 epoch;
+    };
+
+    /** Retirements between attempts to free retired pointers */
+    constexpr static const uint32 RECLAIM_INTERVAL = 64;
+
+    /** Current epoch, starts at 1 since 0 marks inactive readers */
+    atomic<uint64> global_epoch{1};
+    /** Epoch announced by each thread, indexed by epoch_thread_index() */
+    reader_slot readers[EPOCH_MAX_THREADS];
+    /** Pointers waiting to be freed */
+    vector<retired_ptr> retired;
+    /** Guards retired, writers can retire concurrently */
+    mutex retired_lock;
+
+    /** Free every retired pointer no reader can reach anymore, retired_lock has to be held */
+    void reclaim() {
+        // Pairs with the fence of enter(), either we see the reader's epoch or it sees our unlink
+        atomic_thread_fence(memory_order_seq_cst);
+
+        uint64 oldest = UINT64_MAX;
+        for (reader_slot &reader : this->readers) {
+            const uint64 epoch = reader.epoch.load(memory_order_acquire);
+            if (epoch != 0 && epoch < oldest)
+                oldest = epoch;
+        }
+
+        uint32 kept = 0;
+        for (retired_ptr &item : this->retired) {
+            if (item.epoch < oldest) {
+                item.deleter(item.ptr, item.owner);
+            } else {
+                this->retired[kept++] = item;
+            }
+        }
+
+        this->retired.resize(kept);
+    }
+
+  public:
+    epoch_manager() {}
+
+    epoch_manager(const epoch_manager &) = delete;
+
+    /** Deconstructor, nobody can be reading anymore so everything left is freed */
+    ~epoch_manager() {
+        for (retired_ptr &item : this->retired)
+            item.deleter(item.ptr, item.owner);
+    }
+
+    /**
+     * Enter a critical section, pointers read from now on stay valid until leave()
+     * Returns false if the thread already was inside one, that call mustn't be paired with leave()
+     */
+    inline bool enter() {
+        atomic<uint64> &slot = this->readers[epoch_thread_index()].epoch;
+
+        if (slot.load(memory_order_relaxed) != 0)
+            return false;
+
+        slot.store(this->global_epoch.load(memory_order_acquire), memory_order_relaxed);
+        // The announcement has to be visible before anything is read
+        atomic_thread_fence(memory_order_seq_cst);
+        return true;
+    }
+
+    /** Leave the critical section, pointers read inside it can't be used anymore */
+    inline void leave() {
+        this->readers[epoch_thread_index()].epoch.store(0, memory_order_release);
+    }
+
+    /**
+     * Free `ptr` with `deleter(ptr, owner)` once no reader can still see it
+     * Has to be called after `ptr` was unlinked from everything readers can reach
+     */
+    void retire(void *ptr, void (*deleter)(void *, void *), void *owner = nullptr) {
+        // Readers that announce an epoch after this one can't find ptr anymore
+        const uint64 epoch = this->global_epoch.fetch_add(1, memory_order_seq_cst);
+
+        lock_guard<mutex> lock(this->retired_lock);
+        this->retired.push_back({ptr, deleter, owner, epoch});
+
+        if (this->retired.size() % RECLAIM_INTERVAL == 0)
+            this->reclaim();
+    }
+
+    /** Amount of retired pointers that weren't freed yet */
+    uint32 pending() {
+        lock_guard<mutex> lock(this->retired_lock);
+        return this->retired.size();
+    }
+};
+
+/**
+ * RAII critical section of an epoch_manager
+ * Nests, only the outermost guard of a thread announces and leaves, so a reader can hold one around many lookups
+ * to pay for the fence once
+ */
+class epoch_guard {
+  private:
+    epoch_manager &manager;
+    /** Whether this guard entered the critical section, false if it's nested */
+    bool entered;
+
+  public:
+    epoch_guard(epoch_manager &manager) : manager(manager), entered(manager.enter()) {}
+
+    ~epoch_guard() {
+        if (this->entered)
+            this->manager.leave();
+    }
+};
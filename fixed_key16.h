@@ -0,0 +1,73 @@
+#pragma once
+
+#include "hash.h"
+#include "user.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FIXED_KEY16_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/**
+ * Key of up to 16 characters stored inline and zero padded, sized after User::username
+ * Fits a single SSE2 register, so equality is one compare and hashing reads two words
+ * instead of looping over the characters
+ */
+class alignas(16) fixed_key16 {
+  public:
+    /** Max amount of characters, a key of exactly 16 isn't null terminated */
+    constexpr static const uint32 SIZE = 16;
+
+    /** Characters of the key, zero padded */
+    char data[SIZE];
+
+    fixed_key16() : data{} {}
+
+    /** Copies up to SIZE characters of a null terminated string */
+    fixed_key16(const char *key) {
+        strncpy(this->data, key, SIZE);
+    }
+
+    /** Copies up to SIZE characters of the view */
+    explicit fixed_key16(string_view key) : data{} {
+        memcpy(this->data, key.data(), min(key.size(), (size_t)SIZE));
+    }
+
+    /** Characters of the key without the padding */
+    string_view view() const {
+        return string_view(this->data, strnlen(this->data, SIZE));
+    }
+
+    /** Whether both keys hold the same characters, padding included */
+    inline bool operator==(const fixed_key16 &other) const {
+#ifdef FIXED_KEY16_USE_SSE2
+        const __m128i a = _mm_load_si128((const __m128i *)this->data);
+        const __m128i b = _mm_load_si128((const __m128i *)other.data);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xFFFF;
+#else
+        return memcmp(this->data, other.data, SIZE) == 0;
+#endif
+    }
+
+    inline bool operator!=(const fixed_key16 &other) const {
+        return !(*this == other);
+    }
+
+    /**
+     * 64-bit hash of the key, reads it as two words
+     * Each word goes through a multiply so every character affects the high bits (murmur3 finalizer)
+     */
+    inline uint64 hash() const {
+        uint64 low, high;
+        memcpy(&low, this->data, sizeof(uint64));
+        memcpy(&high, this->data + sizeof(uint64), sizeof(uint64));
+
+        return murmur_mix(low * HASH_DEFAULT_SEED ^ high);
+    }
+};
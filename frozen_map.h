@@ -0,0 +1,356 @@
+#pragma once
+
+#include "hash.h"
+#include "map_adt.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+/**
+ * 64-bit hash frozen_map places keys with
+ * Keys with equal hashes can't be told apart by a perfect hash, so it has to be a strong one (std::hash)
+ * Transparent, a string and a string_view with the same characters hash the same
+ */
+class frozen_hash {
+  public:
+    typedef void is_transparent;
+
+    template <typename T> inline uint64 operator()(const T &key) const {
+        return hash<T>()(key);
+    }
+};
+
+/**
+ * Immutable map built once from a whole set of keys with a minimal perfect hash (hash and displace, like PTHash)
+ * Keys are spread over buckets of about BUCKET_LOAD keys, and each bucket gets the first pilot that sends all of its
+ * keys to free positions of a search space slightly bigger than the amount of keys (ALPHA)
+ * Positions past the end of the table are remapped to the ones left free inside it, so the table has exactly one
+ * slot per key
+ * A lookup hashes the key once, reads the pilot of its bucket and lands on the only slot the key can be in,
+ * whose 8-bit fingerprint rejects most misses without comparing keys
+ */
+template <typename K, typename V, typename Hash = frozen_hash, typename KeyEqual = equal_to<K>> class frozen_map {
+  private:
+    /** key-value pair slot */
+    class hash_slot {
+      public:
+        K key;
+        V value;
+    };
+
+    /** Average amount of keys per bucket, more means fewer pilots to store but longer searches for them */
+    constexpr static const uint32 BUCKET_LOAD = 4;
+    /**
+     * Share of the search space filled by keys, the free share is what keeps the search for the last pilots short
+     * (with no free share the last key would need about one try per key to find the only free position)
+     */
+    constexpr static const double ALPHA = 0.97;
+    /** Seeds tried before giving up, a seed fails when some bucket has no pilot that fits in 16 bits */
+    constexpr static const uint32 MAX_SEEDS = 32;
+
+    /** Seed mixed into every hash, changed when a build fails */
+    uint64 seed = 0;
+    /** Heap memory held by the map, every array is allocated through it */
+    memory_stats memory;
+    /** Pilot of each bucket, the displacement that sends its keys to their positions */
+    tracked_vector<uint16> pilots;
+    /** Amount of positions pilots send keys to */
+    uint32 search_size = 0;
+    /** Slot of every position past the end of the table that has a key */
+    tracked_vector<uint32> remap;
+    /** Table where all the slots reside, exactly one per key */
+    tracked_vector<hash_slot> table;
+    /** Bits of the hash of each slot's key, checked before comparing keys */
+    tracked_vector<uint8> fingerprints;
+    /** Hash function, see frozen_hash */
+    Hash hash_fn;
+    /** Key equality, only compared when the fingerprint matches */
+    KeyEqual key_equal;
+
+    /** Seeded hash of a key */
+    template <typename L> inline uint64 key_hash(const L &key) const {
+        return murmur_mix((uint64)this->hash_fn(key) ^ this->seed);
+    }
+
+    /** Bucket of a hash, taken from its high half */
+    inline uint32 bucket_of(uint64 hash) const {
+        return ((hash >> 32) * this->pilots.size()) >> 32;
+    }
+
+    /**
+     * Position a hash lands on with the pilot of its bucket
+     * Mixed after the pilot is applied, with a plain `(hash ^ pilot) % search_size` two keys whose hashes only
+     * differ in bits the modulo drops would collide with every pilot
+     */
+    inline uint32 position_of(uint64 hash, uint32 pilot) const {
+        return murmur_mix(hash ^ (pilot * HASH_DEFAULT_SEED)) % this->search_size;
+    }
+
+    /** Slot of the table a position stands for */
+    inline uint32 slot_of(uint32 position) const {
+        return position < this->table.size() ? position : this->remap[position - this->table.size()];
+    }
+
+    /** Fingerprint of a hash */
+    static inline uint8 fingerprint(uint64 hash) {
+        return hash >> 24;
+    }
+
+    /** Find the slot of a key, or table.size() if it isn't in the map */
+    template <typename L> inline uint32 find(const L &key) const {
+        if (this->table.empty())
+            return 0;
+
+        const uint64 hash = this->key_hash(key);
+        const uint32 slot = this->slot_of(this->position_of(hash, this->pilots[this->bucket_of(hash)]));
+
+        if (this->fingerprints[slot] != fingerprint(hash) || !this->key_equal(this->table[slot].key, key))
+            return this->table.size();
+
+        return slot;
+    }
+
+    /** Build the table with the current seed, false if some bucket had no pilot */
+    template <typename I, typename KeyFn> bool build(I first, uint32 count, KeyFn key_of) {
+        vector<uint64> hashes(count);
+        for (uint32 i = 0; i < count; i++)
+            hashes[i] = this->key_hash(key_of(first[i]));
+
+        this->pilots = tracked_vector<uint16>(count / BUCKET_LOAD + 1, 0, &this->memory);
+
+        // Values grouped by bucket, equal hashes next to each other in the order they were given
+        vector<uint32> order(count);
+        iota(order.begin(), order.end(), 0);
+        sort(order.begin(), order.end(), [&](uint32 a, uint32 b) {
+            const uint32 bucket_a = this->bucket_of(hashes[a]), bucket_b = this->bucket_of(hashes[b]);
+            if (bucket_a != bucket_b)
+                return bucket_a < bucket_b;
+
+            return hashes[a] != hashes[b] ? hashes[a] < hashes[b] : a < b;
+        });
+
+        // Equal keys -> only the last one is kept, like a sequence of puts
+        vector<uint32> entries;
+        entries.reserve(count);
+
+        for (uint32 i : order) {
+            if (!entries.empty() && hashes[entries.back()] == hashes[i]) {
+                if (!this->key_equal(K(key_of(first[entries.back()])), K(key_of(first[i])))) {
+                    cerr << "hash_fn gives two different keys the same hash, they can't be told apart." << endl;
+                    exit(1);
+                }
+
+                entries.back() = i;
+                continue;
+            }
+
+            entries.push_back(i);
+        }
+
+        const uint32 size = entries.size();
+        this->table       = tracked_vector<hash_slot>(size, &this->memory);
+        this->search_size = size / ALPHA + 1;
+
+        // Entries of bucket b are [bucket_starts[b], bucket_starts[b + 1])
+        vector<uint32> bucket_starts(this->pilots.size() + 1, 0);
+        for (uint32 entry : entries)
+            bucket_starts[this->bucket_of(hashes[entry]) + 1]++;
+
+        partial_sum(bucket_starts.begin(), bucket_starts.end(), bucket_starts.begin());
+
+        // Biggest buckets go first, while most of the table is still free
+        vector<uint32> buckets(this->pilots.size());
+        iota(buckets.begin(), buckets.end(), 0);
+        stable_sort(buckets.begin(), buckets.end(), [&](uint32 a, uint32 b) {
+            return bucket_starts[a + 1] - bucket_starts[a] > bucket_starts[b + 1] - bucket_starts[b];
+        });
+
+        vector<bool> taken(this->search_size, false);
+        vector<uint32> positions(size);
+
+        for (uint32 bucket : buckets) {
+            const uint32 start = bucket_starts[bucket], end = bucket_starts[bucket + 1];
+            if (start == end)
+                break;
+
+            // A pilot fits if every key of the bucket lands on a free position, and on a different one than the others
+            const auto fits = [&](uint32 pilot) {
+                for (uint32 j = start; j < end; j++) {
+                    positions[j] = this->position_of(hashes[entries[j]], pilot);
+
+                    if (taken[positions[j]])
+                        return false;
+
+                    for (uint32 k = start; k < j; k++)
+                        if (positions[k] == positions[j])
+                            return false;
+                }
+
+                return true;
+            };
+
+            uint32 pilot = 0;
+            while (!fits(pilot)) {
+                if (pilot == UINT16_MAX)
+                    return false;
+
+                pilot++;
+            }
+
+            this->pilots[bucket] = pilot;
+            for (uint32 j = start; j < end; j++)
+                taken[positions[j]] = true;
+        }
+
+        // As many positions are taken past the end of the table as are free inside it, pair them up in order
+        this->remap      = tracked_vector<uint32>(this->search_size - size, 0, &this->memory);
+        uint32 free_slot = 0;
+
+        for (uint32 position = size; position < this->search_size; position++) {
+            if (!taken[position])
+                continue;
+
+            while (taken[free_slot])
+                free_slot++;
+
+            this->remap[position - size] = free_slot++;
+        }
+
+        this->fingerprints = tracked_vector<uint8>(size, &this->memory);
+
+        for (uint32 j = 0; j < size; j++) {
+            const uint32 entry = entries[j];
+            const uint32 index = this->slot_of(positions[j]);
+            hash_slot &slot    = this->table[index];
+
+            slot.key                  = K(key_of(first[entry]));
+            slot.value                = first[entry];
+            this->fingerprints[index] = fingerprint(hashes[entry]);
+        }
+
+        return true;
+    }
+
+  public:
+    /**
+     * Constructor that builds the map from a whole set of values, with a pair `key_of(value)` -> `value` for each
+     * `values` has to be random access, `key_of` may return a lookup key (see is_lookup_key)
+     * Like a sequence of puts, a later value replaces an earlier one with the same key
+     */
+    template <typename R, typename KeyFn, typename = decltype(std::begin(declval<const R &>()))>
+    frozen_map(const R &values, KeyFn key_of, Hash hash_fn = Hash()) : hash_fn(hash_fn) {
+        const auto first   = std::begin(values);
+        const uint32 count = std::end(values) - first;
+
+        for (uint32 attempt = 1; attempt <= MAX_SEEDS; attempt++) {
+            this->seed = murmur_mix(attempt);
+
+            if (this->build(first, count, key_of))
+                return;
+
+            cout << "[frozen] a bucket has no pilot, retrying with another seed" << endl;
+        }
+
+        cerr << "no perfect hash found for the keys after " << MAX_SEEDS << " seeds." << endl;
+        exit(1);
+    }
+
+    /** Deconstructor, slots are owned by the table */
+    ~frozen_map() {}
+
+    /** Get the value paired with the key */
+    V get(const K &key) const {
+        return this->template get<K>(key);
+    }
+
+    /** Get the value paired with a lookup key, e.g. a string_view for string keys (see is_lookup_key) */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V get(const L &key) const {
+        const uint32 slot = this->find(key);
+        return slot != this->table.size() ? this->table[slot].value : nullptr;
+    }
+
+    /** Whether the key is in the map */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    bool contains(const L &key) const {
+        return this->find(key) != this->table.size();
+    }
+
+    /** Get the current size of the map */
+    uint32 size() const {
+        return this->table.size();
+    }
+
+    /** Whether the map is empty */
+    bool empty() const {
+        return this->table.empty();
+    }
+
+    /** Call `callback(key, value)` for every stored pair, without allocating anything */
+    template <typename F> void for_each(F callback) const {
+        for (const hash_slot &slot : this->table)
+            callback(slot.key, slot.value);
+    }
+
+    /**
+     * Vector with all the stored keys
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<K> keys() const {
+        vector<K> result;
+        result.reserve(this->table.size());
+
+        for (const hash_slot &slot : this->table)
+            result.push_back(slot.key);
+
+        return result;
+    }
+
+    /**
+     * Vector with all the stored values
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<V> values() const {
+        vector<V> result;
+        result.reserve(this->table.size());
+
+        for (const hash_slot &slot : this->table)
+            result.push_back(slot.value);
+
+        return result;
+    }
+
+    /** Heap memory held by the map */
+    const memory_stats &heap_usage() const {
+        return this->memory;
+    }
+
+    /** Print information about the hash map */
+    void info(stringstream &out) const {
+        const uint64 metadata_bits
+            = (uint64)this->pilots.size() * 16 + this->remap.size() * 32 + this->fingerprints.size() * 8;
+
+        uint64 key_bytes = 0;
+        for (const hash_slot &slot : this->table)
+            key_bytes += key_heap_bytes(slot.key);
+
+        out << "[frozen] map info:\n"
+            << "size: " << this->table.size() << "\n"
+            << "buckets: " << this->pilots.size() << "\n"
+            << "metadata: " << (double)metadata_bits / max(this->table.size(), (size_t)1)
+            << " bits per key (16-bit pilots, 32-bit remaps, 8-bit fingerprints)\n";
+
+        this->memory.info(out, sizeof(*this), this->table.size() * (sizeof(K) + sizeof(V)), key_bytes);
+        out << endl;
+    }
+};
@@ -6,7 +6,7 @@ from shutil import rmtree
 
 DATA_DIR = "data/"
 GRAPHS_DIR = "graphs/"
-SUBSETS = ("put", "get_(hit)", "get_(miss)", "remove")
+SUBSETS = ("put", "get_(hit)", "get_(miss)", "remove", "put_batch", "get_batch_(hit)", "get_batch_(miss)")
 TIMING_MEASURE_RANGE = 100
 
 
@@ -36,7 +36,7 @@ def main() -> None:
                 .pivot(index="users", columns="map", values="time")
                 .iloc[:-1, :]
             )
-            average_times = average_times[["sc", "lp", "qp", "dh", "stl"]]
+            average_times = average_times[["sc", "scp", "lp", "qp", "dh", "rh", "sw", "stl"]]
 
             shared_title = (
                 "of map."
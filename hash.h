@@ -0,0 +1,129 @@
+#pragma once
+
+#include "user.h"
+
+#include <cstring>
+#include <string_view>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#define HASH_USE_UMUL128
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+// -- Fast hash kernels -- //
+// Every hash takes its seed and output width as template parameters, so both are folded into the code at compile time
+// BITS keeps the high bits of the 64-bit result, the best mixed ones, e.g. BITS = 32 for an int hash
+
+/** Default seed, the 64-bit golden ratio */
+constexpr const uint64 HASH_DEFAULT_SEED = 0x9E3779B97F4A7C15ull;
+
+/** Secrets mixed in by wy_hash, odd and with about half of their bits set */
+constexpr const uint64 WY_SECRET_0 = 0xA0761D6478BD642Full;
+constexpr const uint64 WY_SECRET_1 = 0xE7037ED1A0B428DBull;
+
+/** Keep the BITS high bits of a 64-bit hash */
+template <uint32 BITS> constexpr uint64 hash_bits(uint64 hash) {
+    static_assert(BITS > 0 && BITS <= 64, "BITS must be between 1 and 64");
+
+    if constexpr (BITS == 64)
+        return hash;
+    else
+        return hash >> (64 - BITS);
+}
+
+/**
+ * Murmur3 64-bit finalizer, every input bit flips about half of the output bits
+ * Two multiply-xorshift rounds
+ */
+template <uint32 BITS = 64, uint64 SEED = 0> constexpr uint64 murmur_mix(uint64 key) {
+    key ^= SEED;
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDull;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ull;
+    key ^= key >> 33;
+    return hash_bits<BITS>(key);
+}
+
+/**
+ * Single multiply-xorshift round (Fibonacci hashing with a fold)
+ * Half the work of murmur_mix, the low input bits only reach the high output bits, which is what BITS keeps
+ */
+template <uint32 BITS = 64, uint64 SEED = HASH_DEFAULT_SEED> constexpr uint64 mulxor_mix(uint64 key) {
+    key *= SEED | 1;
+    key ^= key >> 32;
+    return hash_bits<BITS>(key);
+}
+
+/** Full 128-bit product of a and b, folded into 64 bits by xoring its halves */
+inline uint64 wy_mum(uint64 a, uint64 b) {
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64)product ^ (uint64)(product >> 64);
+#elif defined(HASH_USE_UMUL128)
+    uint64 high;
+    const uint64 low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    const uint64 a_low = (uint32)a, a_high = a >> 32, b_low = (uint32)b, b_high = b >> 32;
+    const uint64 low_low = a_low * b_low, low_high = a_low * b_high, high_low = a_high * b_low;
+    const uint64 middle  = (low_low >> 32) + (uint32)low_high + (uint32)high_low;
+
+    const uint64 low  = (middle << 32) | (uint32)low_low;
+    const uint64 high = a_high * b_high + (low_high >> 32) + (high_low >> 32) + (middle >> 32);
+    return low ^ high;
+#endif
+}
+
+/** Unaligned little-endian reads of 8, 4 and up to 3 bytes */
+inline uint64 wy_read8(const char *bytes) {
+    uint64 value;
+    memcpy(&value, bytes, sizeof(uint64));
+    return value;
+}
+
+inline uint64 wy_read4(const char *bytes) {
+    uint32 value;
+    memcpy(&value, bytes, sizeof(uint32));
+    return value;
+}
+
+inline uint64 wy_read3(const char *bytes, uint32 length) {
+    return ((uint64)(uint8)bytes[0] << 16) | ((uint64)(uint8)bytes[length >> 1] << 8) | (uint8)bytes[length - 1];
+}
+
+/**
+ * wyhash-style string hash, reads 8 or 16 bytes at a time instead of one character
+ * Keys of up to 16 bytes (every username) are read with two overlapping loads and a single 128-bit multiply,
+ * without any loop or branch on the characters
+ */
+template <uint32 BITS = 64, uint64 SEED = HASH_DEFAULT_SEED> inline uint64 wy_hash(string_view key) {
+    const char *bytes   = key.data();
+    const uint32 length = key.size();
+    uint64 seed         = SEED ^ wy_mum(SEED ^ WY_SECRET_0, WY_SECRET_1);
+    uint64 a = 0, b = 0;
+
+    if (length <= 16) {
+        if (length >= 4) {
+            // First and last 4 or 8 bytes, overlapping when the key is shorter than that
+            const uint32 middle = (length >> 3) << 2;
+            a = (wy_read4(bytes) << 32) | wy_read4(bytes + middle);
+            b = (wy_read4(bytes + length - 4) << 32) | wy_read4(bytes + length - 4 - middle);
+        } else if (length > 0) {
+            a = wy_read3(bytes, length);
+        }
+    } else {
+        uint32 left = length;
+
+        for (; left > 16; left -= 16, bytes += 16)
+            seed = wy_mum(wy_read8(bytes) ^ WY_SECRET_1, wy_read8(bytes + 8) ^ seed);
+
+        // Last 16 bytes, overlapping the previous block
+        a = wy_read8(bytes + left - 16);
+        b = wy_read8(bytes + left - 8);
+    }
+
+    return hash_bits<BITS>(wy_mum(WY_SECRET_1 ^ length, wy_mum(a ^ WY_SECRET_1, b ^ seed)));
+}
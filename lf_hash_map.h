@@ -0,0 +1,369 @@
+#pragma once
+
+#include "epoch.h"
+#include "map_adt.h"
+#include "memory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Separate Chaining Hash Map with lock-free reads
+ * Readers take no locks, they only announce an epoch (see epoch.h) and follow pointers published with release stores
+ * Writers are serialized by a mutex, removed nodes and the tables replaced by a rehash are retired and only freed
+ * once no reader can still be looking at them
+ * Meant for read-mostly workloads, a rehash copies every node since readers may still be walking the old chains
+ */
+template <typename K, typename V, typename Capacity = prime_capacity, typename Hash = function<int(K)>,
+          typename KeyEqual = equal_to<K>>
+class lf_hash_map : virtual public map_adt<K, V>, public static_map<lf_hash_map<K, V, Capacity, Hash, KeyEqual>, K, V> {
+  private:
+    static_assert(is_trivially_copyable<V>::value, "V has to fit in an atomic");
+
+    /**
+     * key-value pair node
+     * Only the value and the link can change once a node is published
+     */
+    class hash_node {
+      public:
+        const K key;
+        atomic<V> value;
+        const uint32 hash;
+        atomic<hash_node *> next;
+
+        hash_node(const K &key, V value, uint32 hash, hash_node *next)
+            : key(key), value(value), hash(hash), next(next) {}
+    };
+
+    /** Buckets and the capacity policy indexing them, replaced as a whole on rehash */
+    class bucket_table {
+      public:
+        Capacity capacity;
+        uint32 max_size;
+        tracked_vector<atomic<hash_node *>> buckets;
+
+        bucket_table(uint32 size, memory_stats *memory) : max_size(capacity.resize(size)), buckets(max_size, memory) {
+            for (uint32 i = 0; i < this->max_size; i++)
+                this->buckets[i].store(nullptr, memory_order_relaxed);
+        }
+    };
+
+    /** Target load factor */
+    constexpr static const double LOAD_FACTOR_THRESHOLD = 1.0;
+
+    /** Heap memory held by the map, declared first since retired nodes are freed into it until the very end */
+    memory_stats memory;
+    /** Keeps retired nodes and tables alive while readers may see them */
+    epoch_manager epochs;
+    /** Table readers start from */
+    atomic<bucket_table *> table;
+    /** Size threshold at which the table should be rehashed */
+    uint32 size_threshold;
+    /** Current size of the table */
+    atomic<uint32> current_size{0};
+    /** Serializes put, remove, clear and rehash */
+    mutex write_lock;
+    /** Hash function to calculate the bucket of a key */
+    Hash hash_fn;
+    /** Key equality, only compared on nodes whose stored hash matches */
+    KeyEqual key_equal;
+
+    /** Allocate a node, recorded in the map's memory */
+    hash_node *create_node(const K &key, V value, uint32 hash, hash_node *next) {
+        return new (tracked_malloc(&this->memory, sizeof(hash_node))) hash_node(key, value, hash, next);
+    }
+
+    /** Allocate a table, recorded in the map's memory */
+    bucket_table *create_table(uint32 size) {
+        return new (tracked_malloc(&this->memory, sizeof(bucket_table))) bucket_table(size, &this->memory);
+    }
+
+    /** Deleter of a retired node, `memory` is the memory_stats it was allocated with */
+    static void destroy_node(void *node, void *memory) {
+        ((hash_node *)node)->~hash_node();
+        tracked_free((memory_stats *)memory, node, sizeof(hash_node));
+    }
+
+    /** Deleter of a retired table, frees every node still linked in it too */
+    static void destroy_table(void *ptr, void *memory) {
+        bucket_table *table = (bucket_table *)ptr;
+
+        for (uint32 i = 0; i < table->max_size; i++) {
+            hash_node *node = table->buckets[i].load(memory_order_relaxed);
+
+            while (node != nullptr) {
+                hash_node *next = node->next.load(memory_order_relaxed);
+                destroy_node(node, memory);
+                node = next;
+            }
+        }
+
+        table->~bucket_table();
+        tracked_free((memory_stats *)memory, table, sizeof(bucket_table));
+    }
+
+    /** Find the node holding the key, has to be called inside a critical section or holding the write lock */
+    template <typename L> hash_node *find(bucket_table *table, const L &key, uint32 hash) {
+        hash_node *node = table->buckets[table->capacity.index(hash)].load(memory_order_acquire);
+
+        while (node != nullptr && (node->hash != hash || !this->key_equal(node->key, key)))
+            node = node->next.load(memory_order_acquire);
+
+        return node;
+    }
+
+    /**
+     * Publish `table` in place of the current one, whose nodes are left for readers still walking them
+     * The write lock has to be held
+     */
+    void replace_table(bucket_table *table) {
+        bucket_table *old_table = this->table.load(memory_order_relaxed);
+
+        this->table.store(table, memory_order_release);
+        this->size_threshold = table->max_size * LOAD_FACTOR_THRESHOLD;
+        this->epochs.retire(old_table, destroy_table, &this->memory);
+    }
+
+    /** Rehash holding the write lock, see rehash */
+    void rehash_locked(uint32 size) {
+        bucket_table *old_table = this->table.load(memory_order_relaxed);
+        bucket_table *new_table = this->create_table(size);
+
+        // Copy, don't relink, readers may still be walking the old chains
+        for (uint32 i = 0; i < old_table->max_size; i++) {
+            hash_node *node = old_table->buckets[i].load(memory_order_relaxed);
+
+            while (node != nullptr) {
+                atomic<hash_node *> &bucket = new_table->buckets[new_table->capacity.index(node->hash)];
+                const V value               = node->value.load(memory_order_relaxed);
+                hash_node *head             = bucket.load(memory_order_relaxed);
+                bucket.store(this->create_node(node->key, value, node->hash, head), memory_order_relaxed);
+
+                node = node->next.load(memory_order_relaxed);
+            }
+        }
+
+        this->replace_table(new_table);
+    }
+
+  public:
+    /** Constructor that takes the hash function as a parameter */
+    lf_hash_map(uint32 initial_size, Hash hash_fn = Hash())
+        : table(create_table(initial_size)), hash_fn(hash_fn) {
+        if (is_empty_fn(this->hash_fn)) {
+            cerr << "hash_fn cannot be null." << endl;
+            exit(1);
+        }
+
+        this->size_threshold = this->table.load()->max_size * LOAD_FACTOR_THRESHOLD;
+    }
+
+    /** Deconstructor, frees the table and its nodes, retired ones are freed by the epoch manager */
+    ~lf_hash_map() {
+        destroy_table(this->table.load(), &this->memory);
+    }
+
+    /** Get the value paired with the key */
+    V get(const K &key) {
+        return this->template get<K>(key);
+    }
+
+    /**
+     * Get the value paired with a lookup key, e.g. a string_view for string keys (see is_lookup_key)
+     * Lock-free, only announces an epoch while it's reading
+     */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V get(const L &key) {
+        const uint32 hash = this->hash_fn(key);
+
+        epoch_guard guard(this->epochs);
+        hash_node *node = this->find(this->table.load(memory_order_acquire), key, hash);
+
+        return node != nullptr ? node->value.load(memory_order_acquire) : nullptr;
+    }
+
+    /** Insert a key-value pair */
+    V put(const K &key, V value) {
+        const uint32 hash = this->hash_fn(key);
+
+        lock_guard<mutex> lock(this->write_lock);
+        hash_node *node = this->find(this->table.load(memory_order_relaxed), key, hash);
+
+        // Match -> override value
+        if (node != nullptr) {
+            V previous_value = node->value.load(memory_order_relaxed);
+            node->value.store(value, memory_order_release);
+            return previous_value;
+        }
+
+        const uint32 size = this->current_size.load(memory_order_relaxed);
+        if (size >= this->size_threshold) {
+            cout << "[lf] passed load factor threshold, rehashing" << endl;
+            this->rehash_locked(size * 2);
+        }
+
+        // New node goes at the head of the bucket, fully built before it's published
+        bucket_table *table         = this->table.load(memory_order_relaxed);
+        atomic<hash_node *> &bucket = table->buckets[table->capacity.index(hash)];
+        bucket.store(this->create_node(key, value, hash, bucket.load(memory_order_relaxed)), memory_order_release);
+        this->current_size.store(size + 1, memory_order_relaxed);
+
+        return nullptr;
+    }
+
+    /** Remove a key-value pair by it's key */
+    V remove(const K &key) {
+        return this->template remove<K>(key);
+    }
+
+    /**
+     * Remove a key-value pair by a lookup key
+     * The node is unlinked right away, but it's freed once no reader can still be standing on it
+     */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V remove(const L &key) {
+        const uint32 hash = this->hash_fn(key);
+
+        lock_guard<mutex> lock(this->write_lock);
+        bucket_table *table = this->table.load(memory_order_relaxed);
+
+        // Link pointing to the node, either the bucket or the previous node's next
+        atomic<hash_node *> *link = &table->buckets[table->capacity.index(hash)];
+        hash_node *node           = link->load(memory_order_relaxed);
+
+        while (node != nullptr && (node->hash != hash || !this->key_equal(node->key, key))) {
+            link = &node->next;
+            node = link->load(memory_order_relaxed);
+        }
+
+        // No match
+        if (node == nullptr)
+            return nullptr;
+
+        // Readers standing on the node can still move on through its next link
+        link->store(node->next.load(memory_order_relaxed), memory_order_release);
+        this->current_size.store(this->current_size.load(memory_order_relaxed) - 1, memory_order_relaxed);
+
+        V value = node->value.load(memory_order_relaxed);
+        this->epochs.retire(node, destroy_node, &this->memory);
+
+        return value;
+    }
+
+    /** Get the current size of the map */
+    uint32 size() {
+        return this->current_size.load(memory_order_relaxed);
+    }
+
+    /** Whether the map is empty */
+    bool empty() {
+        return this->size() == 0;
+    }
+
+    /** Clear the map - replaces the table with an empty one of the same size */
+    void clear() {
+        lock_guard<mutex> lock(this->write_lock);
+
+        this->replace_table(this->create_table(this->table.load(memory_order_relaxed)->max_size));
+        this->current_size.store(0, memory_order_relaxed);
+    }
+
+    /**
+     * Rehash table for new target size
+     * The size is rounded up by the capacity policy (next prime or power of two)
+     * Every node is copied into the new table, the old one is retired
+     */
+    void rehash(uint32 size) {
+        lock_guard<mutex> lock(this->write_lock);
+        this->rehash_locked(size);
+    }
+
+    /**
+     * Call `callback(key, value)` for every stored pair, lock-free like get
+     * The whole walk is one critical section, so pairs written meanwhile may or may not be visited
+     * There are no iterators, they would have to keep the epoch announced between increments
+     */
+    template <typename F> void for_each(F callback) {
+        epoch_guard guard(this->epochs);
+        bucket_table *table = this->table.load(memory_order_acquire);
+
+        for (uint32 i = 0; i < table->max_size; i++) {
+            hash_node *node = table->buckets[i].load(memory_order_acquire);
+
+            while (node != nullptr) {
+                callback(node->key, node->value.load(memory_order_acquire));
+                node = node->next.load(memory_order_acquire);
+            }
+        }
+    }
+
+    /**
+     * Vector with all the stored keys
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<K> keys() {
+        vector<K> result;
+        result.reserve(this->size());
+
+        this->for_each([&result](const K &key, V) { result.push_back(key); });
+
+        return result;
+    }
+
+    /**
+     * Vector with all the stored values
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<V> values() {
+        vector<V> result;
+        result.reserve(this->size());
+
+        this->for_each([&result](const K &, V value) { result.push_back(value); });
+
+        return result;
+    }
+
+    /** Heap memory held by the map */
+    const memory_stats &heap_usage() const {
+        return this->memory;
+    }
+
+    /** Print information about the hash map */
+    void info(stringstream &out) {
+        int max_depth = 0;
+
+        epoch_guard guard(this->epochs);
+        bucket_table *table = this->table.load(memory_order_acquire);
+
+        for (uint32 i = 0; i < table->max_size; i++) {
+            int depth       = 0;
+            hash_node *node = table->buckets[i].load(memory_order_acquire);
+
+            while (node != nullptr) {
+                depth++;
+                node = node->next.load(memory_order_acquire);
+            }
+
+            max_depth = max(max_depth, depth);
+        }
+
+        out << "[lf] map info:\n"
+            << "max size: " << table->max_size << " (" << Capacity::name << ")\n"
+            << "max depth: " << max_depth << " in same bucket" << "\n"
+            << "size: " << this->size() << "\n"
+            << "load factor: " << (double)this->size() / table->max_size << "\n"
+            << "retired, not freed yet: " << this->epochs.pending() << "\n";
+
+        this->memory.info(out, sizeof(*this), this->size() * (sizeof(K) + sizeof(V)), this->key_heap_usage());
+        out << endl;
+    }
+};
@@ -1,11 +1,15 @@
 #pragma once
 
 #include "map_adt.h"
+#include "memory.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <sstream>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
@@ -13,121 +17,224 @@ using namespace std;
 
 /**
  * Linear Probing Hash Map
+ * With `STORE_HASH` every slot keeps the hash of its key, see slot_hash
  */
-template <typename K, typename V> class lp_hash_map : virtual public map_adt<K, V> {
+template <typename K, typename V, typename Capacity = prime_capacity, typename Hash = function<int(K)>,
+          typename KeyEqual = equal_to<K>, bool STORE_HASH = false>
+class lp_hash_map : virtual public map_adt<K, V>,
+                    public static_map<lp_hash_map<K, V, Capacity, Hash, KeyEqual, STORE_HASH>, K, V> {
   private:
+    friend class static_map<lp_hash_map, K, V>;
+
     /**
-     * key-value pair node
+     * key-value pair slot
+     * Stored inline in the table, so probing never leaves its memory
      */
-    class hash_node {
+    class hash_slot : public slot_hash<STORE_HASH> {
       public:
         K key;
         V value;
-
-        hash_node(K key, V value) : key(key), value(value) {}
     };
 
+    friend class slot_iterator<lp_hash_map, hash_slot>;
+
+    /** Occupancy state of a slot */
+    enum slot_state : uint8 { EMPTY, FULL };
+
     /** Target load factor */
     constexpr static const double LOAD_FACTOR_THRESHOLD = 0.75;
+    /** Least amount of values each thread of build_from gets, fewer don't pay for starting a thread */
+    constexpr static const uint32 BUILD_MIN_PER_THREAD = 4096;
 
+    /** Policy deciding the size of the table and how hashes are reduced to indexes */
+    Capacity capacity;
     /** Max size of the table */
     uint32 max_size;
     /** Size threshold at which the table should be rehashed */
     uint32 size_threshold;
-    /** Table where all the nodes reside */
-    vector<hash_node *> table;
+    /** Heap memory held by the map, every table is allocated through it */
+    memory_stats memory;
+    /** Table where all the slots reside */
+    tracked_vector<hash_slot> table;
+    /** Occupancy state of each slot, kept apart so probes only touch a byte per slot */
+    tracked_vector<uint8> states;
     /** Current size of the table */
     uint32 current_size = 0;
     /** Hash function to calculate the initial index to insert the value at */
-    function<int(K)> hash_fn;
+    Hash hash_fn;
+    /** Key equality, compared on every probed candidate */
+    KeyEqual key_equal;
+
+    /**
+     * Find the index of the slot holding the key, or of the empty slot ending its cluster if there's none
+     * Deletion never leaves holes inside a cluster, so the first empty slot ends the search
+     */
+    template <typename L> uint32 find(const L &key) {
+        return this->find(key, this->hash_fn(key));
+    }
+
+    /** Find with the already calculated hash of the key */
+    template <typename L> uint32 find(const L &key, uint32 hash) {
+        uint32 index = this->capacity.index(hash);
+
+        while (this->states[index] != EMPTY
+               && !(this->table[index].may_match(hash) && this->key_equal(this->table[index].key, key)))
+            index = this->capacity.wrap(index + 1);
+
+        return index;
+    }
+
+    /** Hash of the key of an occupied slot, read back from the slot when hashes are stored */
+    inline uint32 hash_of(const hash_slot &slot) {
+        if constexpr (STORE_HASH) {
+            return slot.hash;
+        } else {
+            return this->hash_fn(slot.key);
+        }
+    }
+
+    /** Insert a key that isn't in the map yet into the first empty slot of its cluster */
+    void insert_absent(K &&key, V value, uint32 hash) {
+        uint32 index = this->capacity.index(hash);
+
+        while (this->states[index] != EMPTY)
+            index = this->capacity.wrap(index + 1);
+
+        hash_slot &slot = this->table[index];
+        slot.key        = move(key);
+        slot.value      = value;
+        slot.store_hash(hash);
+        this->states[index] = FULL;
+        this->current_size++;
+    }
+
+    /** Start loading the home slot of a key into cache, returns the hash get_prefetched resolves it with */
+    template <typename L> uint64 prefetch_slots(const L &key) {
+        const uint32 hash  = this->hash_fn(key);
+        const uint32 index = this->capacity.index(hash);
+        prefetch(&this->states[index]);
+        prefetch(&this->table[index]);
+        return hash;
+    }
+
+    /** Get the value paired with a key whose slots were already prefetched */
+    template <typename L> V get_prefetched(const L &key, uint64 hash) {
+        const uint32 index = this->find(key, hash);
+        return this->states[index] == FULL ? this->table[index].value : nullptr;
+    }
+
+    /** Whether a slot holds a key-value pair */
+    inline bool occupied(uint32 index) const {
+        return this->states[index] == FULL;
+    }
 
   public:
     /** Constructor that takes the hash function as a parameter */
-    lp_hash_map(uint32 initial_size, function<int(K)> hash_fn)
-        : max_size(initial_size), size_threshold(initial_size * LOAD_FACTOR_THRESHOLD), table(initial_size, nullptr),
-          hash_fn(hash_fn) {
-        if (hash_fn == nullptr) {
+    lp_hash_map(uint32 initial_size, Hash hash_fn = Hash())
+        : max_size(capacity.resize(initial_size)), size_threshold(max_size * LOAD_FACTOR_THRESHOLD),
+          table(max_size, &memory), states(max_size, EMPTY, &memory), hash_fn(hash_fn) {
+        if (is_empty_fn(this->hash_fn)) {
             cerr << "hash_fn cannot be null." << endl;
             exit(1);
         }
     }
 
-    /** Deconstructor, frees allocated memory */
-    ~lp_hash_map() {
-        this->clear();
-    }
+    /** Constructor that builds the map from a whole set of values at once, see build_from */
+    template <typename R, typename KeyFn, typename = decltype(std::begin(declval<const R &>()))>
+    lp_hash_map(
+        const R &values, KeyFn key_of, Hash hash_fn = Hash(), uint32 threads = thread::hardware_concurrency()
+    )
+        : hash_fn(hash_fn) {
+        if (is_empty_fn(this->hash_fn)) {
+            cerr << "hash_fn cannot be null." << endl;
+            exit(1);
+        }
 
-    /** Get the value paired with the key */
-    V get(K key) {
-        int index      = this->hash_fn(key) % this->max_size;
-        uint32 counter = 0;
+        this->build_from(values, key_of, threads);
+    }
 
-        hash_node *node = this->table[index];
+    /** Deconstructor, slots are owned by the table */
+    ~lp_hash_map() {}
 
-        // Stop once we run through the entire table or find a match
-        while (counter <= this->max_size && (node != nullptr ? node->key != key : true)) {
-            counter++;
-            index = (index + 1) % this->max_size;
-            node  = this->table[index];
-        }
+    /** Get the value paired with the key */
+    V get(const K &key) {
+        return this->template get<K>(key);
+    }
 
-        return node != nullptr ? node->value : nullptr;
+    /** Get the value paired with a lookup key, e.g. a string_view for string keys (see is_lookup_key) */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V get(const L &key) {
+        const uint32 index = this->find(key);
+        return this->states[index] == FULL ? this->table[index].value : nullptr;
     }
 
     /** Insert a key-value pair */
-    V put(K key, V value) {
+    V put(const K &key, V value) {
         if (this->current_size >= this->size_threshold) {
             cout << "[lp] passed load factor threshold, rehashing" << endl;
-            this->rehash(this->current_size * 2);
+            // Always grows, doubling a tiny size may round back to the same table and let it fill up,
+            // and probing for a missing key only stops at an empty slot
+            this->rehash(max(this->current_size * 2, this->max_size + 1));
         }
 
-        int index = this->hash_fn(key) % this->max_size;
-
-        hash_node *node = this->table[index];
-
-        // Stop once we find an empty node or a match
-        while (node != nullptr && node->key != key) {
-            index = (index + 1) % this->max_size;
-            node  = this->table[index];
-        }
+        const uint32 hash  = this->hash_fn(key);
+        const uint32 index = this->find(key, hash);
+        hash_slot &slot    = this->table[index];
 
-        // Found empty node
-        if (node == nullptr) {
-            this->table[index] = new hash_node(key, value);
+        // Found empty slot
+        if (this->states[index] == EMPTY) {
+            slot.key   = key;
+            slot.value = value;
+            slot.store_hash(hash);
+            this->states[index] = FULL;
             this->current_size++;
             return nullptr;
         }
 
         // Match -> override value
-        V previous_value = node->value;
-        node->value      = value;
+        V previous_value = slot.value;
+        slot.value       = value;
 
         return previous_value;
     }
 
-    /** Remove a key-value pair by it's key */
-    V remove(K key) {
-        int index      = this->hash_fn(key) % this->max_size;
-        uint32 counter = 0;
+    /**
+     * Remove a key-value pair by it's key
+     * Following entries of the cluster are shifted back into the hole when it lies between them and their
+     * home slot, so the cluster stays contiguous and no tombstones are needed
+     */
+    V remove(const K &key) {
+        return this->template remove<K>(key);
+    }
 
-        hash_node *node = this->table[index];
-
-        // Stop once we run through the entire table or find a match
-        while (counter <= this->max_size && (node != nullptr ? node->key != key : true)) {
-            counter++;
-            index = (index + 1) % this->max_size;
-            node  = this->table[index];
-        }
+    /** Remove a key-value pair by a lookup key */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V remove(const L &key) {
+        uint32 index = this->find(key);
 
         // No match
-        if (node == nullptr)
+        if (this->states[index] == EMPTY)
             return nullptr;
 
-        // Match -> delete node
-        V value = node->value;
+        V value = this->table[index].value;
+
+        uint32 next = this->capacity.wrap(index + 1);
+        while (this->states[next] != EMPTY) {
+            const uint32 home = this->capacity.index(this->hash_of(this->table[next]));
+
+            // Home is cyclically outside of (index, next] -> the entry would be cut off by the hole, move it back
+            const bool reachable = index < next ? index < home && home <= next : index < home || home <= next;
+            if (!reachable) {
+                this->table[index] = move(this->table[next]);
+                index              = next;
+            }
+
+            next = this->capacity.wrap(next + 1);
+        }
 
-        this->table[index] = nullptr;
-        delete node;
+        // Last moved slot (or the match itself) -> empty slot
+        this->table[index]  = hash_slot();
+        this->states[index] = EMPTY;
         this->current_size--;
 
         return value;
@@ -143,15 +250,14 @@ template <typename K, typename V> class lp_hash_map : virtual public map_adt<K,
         return this->current_size == 0;
     }
 
-    /** Clear the map - frees allocated memory */
+    /** Clear the map - resets every slot but keeps the table's capacity */
     void clear() {
         for (uint32 i = 0; i < this->max_size; i++) {
-            hash_node *node = this->table[i];
-            if (node == nullptr)
+            if (this->states[i] == EMPTY)
                 continue;
 
-            this->table[i] = nullptr;
-            delete node;
+            this->table[i]  = hash_slot();
+            this->states[i] = EMPTY;
         }
 
         this->current_size = 0;
@@ -159,29 +265,155 @@ template <typename K, typename V> class lp_hash_map : virtual public map_adt<K,
 
     /**
      * Rehash table for new target size
-     * If the size isn't a prime, the next prime is selected
+     * The size is rounded up by the capacity policy (next prime or power of two)
      * Very costly operation, can be avoided by choosing an appropriate initial size
-     * Can also end up being recursive if there's integer overflow
+     * Keys aren't hashed again when hashes are stored
      */
     void rehash(uint32 size) {
         // Move, don't copy
-        vector<hash_node *> nodes = move(this->table);
+        tracked_vector<hash_slot> slots = move(this->table);
+        tracked_vector<uint8> states    = move(this->states);
 
-        for (uint32 i = 0; i < this->max_size; i++) {
-            this->table[i] = nullptr;
+        // Calculate new size and apply
+        const uint32 new_size = this->capacity.resize(size);
+        this->table           = tracked_vector<hash_slot>(new_size, &this->memory);
+        this->states          = tracked_vector<uint8>(new_size, EMPTY, &this->memory);
+        this->current_size    = 0;
+        this->max_size        = new_size;
+        this->size_threshold  = new_size * LOAD_FACTOR_THRESHOLD;
+
+        // Reinsert slots, keys are already known to be unique
+        for (uint32 i = 0; i < slots.size(); i++) {
+            if (states[i] == FULL) {
+                const uint32 hash = this->hash_of(slots[i]);
+                this->insert_absent(move(slots[i].key), slots[i].value, hash);
+            }
         }
+    }
 
-        // Calculate new size and apply
-        const uint32 new_size = find_next_prime(size);
-        this->table.resize(new_size);
-        this->current_size   = 0;
-        this->max_size       = new_size;
-        this->size_threshold = new_size * LOAD_FACTOR_THRESHOLD;
+    /**
+     * Replace the contents of the map with a pair `key_of(value)` -> `value` for every value in `values`
+     * The table is sized for all of them up front, so it's never rehashed while building
+     * Keys are hashed in parallel and partitioned by the region of the table their home slot falls in,
+     * then each region is filled by its own thread. Entries whose cluster runs past the end of their region
+     * are put one by one afterwards
+     * `values` has to be random access, `key_of` may return a lookup key (see is_lookup_key)
+     * Like a sequence of puts, a later value replaces an earlier one with the same key
+     */
+    template <typename R, typename KeyFn>
+    void build_from(const R &values, KeyFn key_of, uint32 threads = thread::hardware_concurrency()) {
+        const auto first   = std::begin(values);
+        const uint32 count = std::end(values) - first;
+
+        // Sized so that every value fits below the load factor threshold
+        const uint32 new_size = this->capacity.resize(count / LOAD_FACTOR_THRESHOLD + 1);
+        this->table           = tracked_vector<hash_slot>(new_size, &this->memory);
+        this->states          = tracked_vector<uint8>(new_size, EMPTY, &this->memory);
+        this->current_size    = 0;
+        this->max_size        = new_size;
+        this->size_threshold  = new_size * LOAD_FACTOR_THRESHOLD;
+
+        // Thread t hashes the t-th chunk of the values and fills the t-th region of the table
+        threads = clamp(count / BUILD_MIN_PER_THREAD, 1u, max(threads, 1u));
+
+        const auto chunk_start = [&](uint32 t) -> uint32 { return (uint64)count * t / threads; };
+        const auto region_of   = [&](uint32 index) -> uint32 { return (uint64)index * threads / new_size; };
+        // First index past region r, the smallest one region_of maps to r + 1
+        const auto region_end = [&](uint32 r) -> uint32 {
+            return ((uint64)new_size * (r + 1) + threads - 1) / threads;
+        };
+
+        vector<uint32> hashes(count);
+        // Entries of chunk t in region r at [t * threads + r], turned into where they go in `order` afterwards
+        vector<uint32> offsets(threads * threads);
+
+        parallel_for(threads, [&](uint32 t) {
+            vector<uint32> counts(threads, 0);
+
+            for (uint32 i = chunk_start(t); i < chunk_start(t + 1); i++) {
+                hashes[i] = this->hash_fn(key_of(first[i]));
+                counts[region_of(this->capacity.index(hashes[i]))]++;
+            }
+
+            copy(counts.begin(), counts.end(), offsets.begin() + t * threads);
+        });
+
+        // Regions one after the other, chunks in order inside each, so equal keys keep the order of `values`
+        vector<uint32> region_starts(threads + 1, count);
+        uint32 offset = 0;
+
+        for (uint32 r = 0; r < threads; r++) {
+            region_starts[r] = offset;
+
+            for (uint32 t = 0; t < threads; t++) {
+                const uint32 amount       = offsets[t * threads + r];
+                offsets[t * threads + r]  = offset;
+                offset                   += amount;
+            }
+        }
+
+        vector<uint32> order(count);
 
-        // Reinsert nodes
-        for (hash_node *node : nodes)
-            if (node != nullptr)
-                this->put(node->key, node->value);
+        parallel_for(threads, [&](uint32 t) {
+            for (uint32 i = chunk_start(t); i < chunk_start(t + 1); i++)
+                order[offsets[t * threads + region_of(this->capacity.index(hashes[i]))]++] = i;
+        });
+
+        // Probes never leave their region, so the regions are filled without any locking
+        vector<vector<uint32>> overflow(threads);
+        vector<uint32> inserted(threads);
+
+        parallel_for(threads, [&](uint32 r) {
+            const uint32 end = region_end(r);
+            uint32 added     = 0;
+
+            for (uint32 j = region_starts[r]; j < region_starts[r + 1]; j++) {
+                const uint32 i    = order[j];
+                const uint32 hash = hashes[i];
+                const auto &key   = key_of(first[i]);
+
+                uint32 index = this->capacity.index(hash);
+                while (index < end && this->states[index] != EMPTY
+                       && !(this->table[index].may_match(hash) && this->key_equal(this->table[index].key, key)))
+                    index++;
+
+                if (index == end) {
+                    overflow[r].push_back(i);
+                    continue;
+                }
+
+                if (this->states[index] == EMPTY) {
+                    this->table[index].key = K(key);
+                    this->table[index].store_hash(hash);
+                    this->states[index] = FULL;
+                    added++;
+                }
+
+                this->table[index].value = first[i];
+            }
+
+            inserted[r] = added;
+        });
+
+        for (uint32 added : inserted)
+            this->current_size += added;
+
+        // Equal keys share their home, so they overflowed from the same region and in order
+        for (const vector<uint32> &entries : overflow)
+            for (uint32 i : entries)
+                this->put(K(key_of(first[i])), first[i]);
+    }
+
+    /** Read-only forward iterator over the stored pairs, invalidated by any put, remove or rehash */
+    typedef slot_iterator<lp_hash_map, hash_slot> iterator;
+
+    /** Iterator to the first stored pair, pairs are visited in table order */
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, this->max_size);
     }
 
     /**
@@ -190,10 +422,10 @@ template <typename K, typename V> class lp_hash_map : virtual public map_adt<K,
      */
     vector<K> keys() {
         vector<K> result;
+        result.reserve(this->current_size);
 
-        for (hash_node *node : this->table)
-            if (node != nullptr)
-                result.push_back(node->key);
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.key);
 
         return result;
     }
@@ -204,25 +436,28 @@ template <typename K, typename V> class lp_hash_map : virtual public map_adt<K,
      */
     vector<V> values() {
         vector<V> result;
+        result.reserve(this->current_size);
 
-        for (hash_node *node : this->table)
-            if (node != nullptr)
-                result.push_back(node->value);
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.value);
 
         return result;
     }
 
+    /** Heap memory held by the map */
+    const memory_stats &heap_usage() const {
+        return this->memory;
+    }
+
     /** Print information about the hash map */
     void info(stringstream &out) {
         out << "[lp] map info:\n"
-            << "max size: " << this->max_size << "\n"
+            << "max size: " << this->max_size << " (" << Capacity::name << ")\n"
             << "size: " << this->current_size << "\n"
             << "load factor: " << (double)this->current_size / this->max_size << "\n"
-            << "size in memory: "
-            << sizeof(*this)
-                   + this->current_size
-                         * (sizeof(hash_node *) + sizeof(hash_node) + (is_pointer<V>::value ? sizeof(*(V){nullptr}) : 0))
-            << " B\n"
-            << endl;
+            << "stored hashes: " << (STORE_HASH ? "yes" : "no") << "\n";
+
+        this->memory.info(out, sizeof(*this), this->current_size * (sizeof(K) + sizeof(V)), this->key_heap_usage());
+        out << endl;
     }
 };
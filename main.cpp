@@ -1,20 +1,19 @@
+#include "fixed_key16.h"
+#include "hash.h"
 #include "performance.h"
 #include "read_csv.h"
+#include "snapshot.h"
 #include "tests.h"
 #include "user.h"
 
-#include <cmath>
 #include <cstdlib>
-#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
-#ifdef _WIN32
-#define lltoa _i64toa
-#endif
-
 using namespace std;
 
 // Sizes for all the hash maps
@@ -30,38 +29,45 @@ template <int mod> int mod_hash(uint64 id) {
     return mod - (id % mod);
 }
 
+/**
+ * Splits the decimal digits of the id in 2 or 3 chunks and adds them up
+ * The chunks are cut out with divisions by powers of ten instead of printing the id
+ */
 template <int mod> int folding_hash(uint64 id) {
     if (id < 1000000000)
         return mod_hash<mod>(id);
 
-    char string_id[20];
-    lltoa(id, string_id, 10);
-    const int length        = strnlen(string_id, 20);
+    int length = 10;
+    while (length < 20 && id >= POWERS_OF_10[length])
+        length++;
+
     const int chunks_amount = length > 15 ? 3 : 2;
-    const int chunk_size    = ceil((float)length / chunks_amount);
+    const int chunk_size    = (length + chunks_amount - 1) / chunks_amount;
 
     int hashed = 0;
     for (int i = 0; i < chunks_amount; i++) {
+        // Digits [start, end) counting from the most significant one, the last chunk may be shorter
         const int start = chunk_size * i;
-        const int end   = start + chunk_size;
-        char chunk[chunk_size + 1];
-
-        int k = 0;
-        for (int j = start; j < end; j++)
-            chunk[k++] = string_id[j];
-
-        chunk[k] = 0;
-        hashed += atoi(chunk);
+        const int end   = min(start + chunk_size, length);
+        hashed += (id / POWERS_OF_10[length - end]) % POWERS_OF_10[end - start];
     }
 
     return mod - (hashed % mod);
 }
 
-template <int size> int username_default_hash(const string &username) {
-    return size - (hash<string>{}(username) % size);
+template <int mod> int murmur_hash(uint64 id) {
+    return mod - (murmur_mix<32>(id) % mod);
+}
+
+template <int mod> int mulxor_hash(uint64 id) {
+    return mod - (mulxor_mix<32>(id) % mod);
+}
+
+template <int size> int username_default_hash(string_view username) {
+    return size - (hash<string_view>{}(username) % size);
 }
 
-template <int size> int username_djb2_hash(const string &username) {
+template <int size> int username_djb2_hash(string_view username) {
     uint32 hash_val = 0;
 
     for (const char c : username)
@@ -70,7 +76,7 @@ template <int size> int username_djb2_hash(const string &username) {
     return size - (hash_val % size);
 }
 
-template <int size> int username_sdbm_hash(const string &username) {
+template <int size> int username_sdbm_hash(string_view username) {
     uint32 hash_val = 0;
 
     for (const char c : username)
@@ -79,7 +85,7 @@ template <int size> int username_sdbm_hash(const string &username) {
     return size - (hash_val % size);
 }
 
-template <int size> int username_seeded_hash(const string &username) {
+template <int size> int username_seeded_hash(string_view username) {
     int h = 0;
 
     for (const char c : username)
@@ -88,7 +94,7 @@ template <int size> int username_seeded_hash(const string &username) {
     return size - h;
 }
 
-template <int size> int username_shifting_hash(const string &username) {
+template <int size> int username_shifting_hash(string_view username) {
     uint32 hash = 0;
 
     for (const char c : username) {
@@ -104,11 +110,52 @@ template <int size> int username_shifting_hash(const string &username) {
     return size - (hash % size);
 }
 
+template <int size> int username_wy_hash(string_view username) {
+    return size - (wy_hash<32>(username) % size);
+}
+
+template <int size> int username_fixed16_hash(const fixed_key16 &username) {
+    return size - (username.hash() % size);
+}
+
 int main(const int argc, const char *argv[]) {
     // Number of tests to run (default: 100)
-    const int tests = argc > 1 ? max(stoi(argv[1]), 1) : 100;
+    int tests = 100;
+    // Read the users from the binary snapshot of the CSV instead of parsing it (--snapshot)
+    bool from_snapshot = false;
+    // Check the snapshot's records against their checksum when loading it (--verify)
+    bool verify_snapshot = false;
+
+    for (int i = 1; i < argc; i++) {
+        const string_view arg = argv[i];
+
+        if (arg == "--csv") {
+            from_snapshot = false;
+        } else if (arg == "--snapshot") {
+            from_snapshot = true;
+        } else if (arg == "--verify") {
+            verify_snapshot = true;
+        } else if (arg.substr(0, 2) == "--") {
+            cerr << "usage: " << argv[0] << " [tests] [--csv | --snapshot [--verify]]" << endl;
+            exit(1);
+        } else {
+            tests = max(stoi(argv[i]), 1);
+        }
+    }
 
-    const vector<const User *> users = read_csv("universities_followers.csv");
+    // Snapshot users are records of its mapping, it has to outlive them
+    unique_ptr<user_snapshot> snapshot;
+    // Users read from the CSV
+    vector<const User *> csv_users;
+    user_list users;
+
+    if (from_snapshot) {
+        snapshot = load_snapshot("universities_followers.csv", "universities_followers.snapshot", verify_snapshot);
+        users    = snapshot->users();
+    } else {
+        csv_users = read_csv("universities_followers.csv");
+        users     = csv_users;
+    }
 
     if (filesystem::exists("data")) {
         filesystem::remove_all("data");
@@ -121,14 +168,38 @@ int main(const int argc, const char *argv[]) {
     performance t;
     t.start();
 
+    // Correctness checks before measuring anything: maps that start out tiny and ids read_csv can't fully parse
+    run_tiny_table_tests(users);
+    run_ambiguous_id_tests();
+
     run_tests<uint64, SC_N, L_N>(
         "id_mod", //
         tests,
         users,
         [](const User *user) { return user->id; },
-        mod_hash<SC_N>,
-        mod_hash<L_N>,
-        mod_hash<DH_N>
+        static_hash<mod_hash<SC_N>>(),
+        static_hash<mod_hash<L_N>>(),
+        static_hash<mod_hash<DH_N>>()
+    );
+
+    run_tests<uint64, SC_N, L_N, prime_capacity, true>(
+        "id_mod_dynamic", //
+        tests,
+        users,
+        [](const User *user) { return user->id; },
+        function<int(const uint64 &)>(mod_hash<SC_N>),
+        function<int(const uint64 &)>(mod_hash<L_N>),
+        function<int(const uint64 &)>(mod_hash<DH_N>)
+    );
+
+    run_tests<uint64, SC_N, L_N, pow2_capacity>(
+        "id_mod_pow2", //
+        tests,
+        users,
+        [](const User *user) { return user->id; },
+        static_hash<mod_hash<SC_N>>(),
+        static_hash<mod_hash<L_N>>(),
+        static_hash<mod_hash<DH_N>>()
     );
 
     run_tests<uint64, SC_N, L_N>(
@@ -136,49 +207,210 @@ int main(const int argc, const char *argv[]) {
         tests,
         users,
         [](const User *user) { return user->id; },
-        folding_hash<SC_N>,
-        folding_hash<L_N>,
-        mod_hash<DH_N>
+        static_hash<folding_hash<SC_N>>(),
+        static_hash<folding_hash<L_N>>(),
+        static_hash<mod_hash<DH_N>>()
+    );
+
+    run_tests<uint64, SC_N, L_N>(
+        "id_murmur", //
+        tests,
+        users,
+        [](const User *user) { return user->id; },
+        static_hash<murmur_hash<SC_N>>(),
+        static_hash<murmur_hash<L_N>>(),
+        static_hash<mod_hash<DH_N>>()
     );
 
     run_tests<string, SC_N, L_N>(
         "username_djb2", //
         tests,
         users,
-        [](const User *user) { return user->username; },
-        username_djb2_hash<SC_N>,
-        username_djb2_hash<L_N>,
-        username_default_hash<DH_N>
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_djb2_hash<SC_N>>(),
+        static_hash<username_djb2_hash<L_N>>(),
+        static_hash<username_default_hash<DH_N>>()
+    );
+
+    run_tests<string, SC_N, L_N, prime_capacity, true>(
+        "username_djb2_dynamic", //
+        tests,
+        users,
+        [](const User *user) { return string(user->username); },
+        function<int(const string &)>(username_djb2_hash<SC_N>),
+        function<int(const string &)>(username_djb2_hash<L_N>),
+        function<int(const string &)>(username_default_hash<DH_N>)
+    );
+
+    run_tests<string, SC_N, L_N, prime_capacity, false, true>(
+        "username_djb2_stored_hash", //
+        tests,
+        users,
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_djb2_hash<SC_N>>(),
+        static_hash<username_djb2_hash<L_N>>(),
+        static_hash<username_default_hash<DH_N>>()
+    );
+
+    run_tests<string, SC_N, L_N, pow2_capacity>(
+        "username_djb2_pow2", //
+        tests,
+        users,
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_djb2_hash<SC_N>>(),
+        static_hash<username_djb2_hash<L_N>>(),
+        static_hash<username_default_hash<DH_N>>()
+    );
+
+    run_tests<fixed_key16, SC_N, L_N>(
+        "username_fixed16", //
+        tests,
+        users,
+        [](const User *user) { return fixed_key16(user->username); },
+        static_hash<username_fixed16_hash<SC_N>>(),
+        static_hash<username_fixed16_hash<L_N>>(),
+        static_hash<username_fixed16_hash<DH_N>>()
+    );
+
+    run_tests<string, SC_N, L_N>(
+        "username_wy", //
+        tests,
+        users,
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_wy_hash<SC_N>>(),
+        static_hash<username_wy_hash<L_N>>(),
+        static_hash<username_default_hash<DH_N>>()
     );
 
     run_tests<string, SC_N, L_N>(
         "username_sdbm", //
         tests,
         users,
-        [](const User *user) { return user->username; },
-        username_sdbm_hash<SC_N>,
-        username_sdbm_hash<L_N>,
-        username_default_hash<DH_N>
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_sdbm_hash<SC_N>>(),
+        static_hash<username_sdbm_hash<L_N>>(),
+        static_hash<username_default_hash<DH_N>>()
     );
 
     run_tests<string, SC_N, L_N>(
         "username_shifting", //
         tests,
         users,
-        [](const User *user) { return user->username; },
-        username_shifting_hash<SC_N>,
-        username_shifting_hash<L_N>,
-        username_default_hash<DH_N>
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_shifting_hash<SC_N>>(),
+        static_hash<username_shifting_hash<L_N>>(),
+        static_hash<username_default_hash<DH_N>>()
     );
 
     run_tests<string, SC_N, L_N>(
         "username_seeded", //
         tests,
         users,
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_seeded_hash<SC_N>>(),
+        static_hash<username_seeded_hash<L_N>>(),
+        static_hash<username_default_hash<DH_N>>()
+    );
+
+    // Put tail latency while the maps grow, stop-the-world vs incremental resizing
+    run_put_latency_tests<uint64>(
+        "id_mod", //
+        tests,
+        users,
+        [](const User *user) { return user->id; },
+        static_hash<mod_hash<SC_N>>(),
+        static_hash<mod_hash<L_N>>(),
+        static_hash<mod_hash<DH_N>>()
+    );
+
+    run_put_latency_tests<string>(
+        "username_djb2", //
+        tests,
+        users,
         [](const User *user) { return user->username; },
-        username_seeded_hash<SC_N>,
-        username_seeded_hash<L_N>,
-        username_default_hash<DH_N>
+        static_hash<username_djb2_hash<SC_N>>(),
+        static_hash<username_djb2_hash<L_N>>(),
+        static_hash<username_default_hash<DH_N>>()
+    );
+
+    // Throughput scaling with threads, sharded map vs a single map behind a global lock
+    run_concurrent_tests<uint64, L_N>(
+        "id_mod", //
+        tests,
+        users,
+        [](const User *user) { return user->id; },
+        static_hash<mod_hash<L_N>>()
+    );
+
+    run_concurrent_tests<string, L_N>(
+        "username_djb2", //
+        tests,
+        users,
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_djb2_hash<L_N>>()
+    );
+
+    // Filling a map from every user at once, one put at a time vs build_from
+    run_build_tests<uint64>(
+        "id_mod", //
+        tests,
+        users,
+        [](const User *user) { return user->id; },
+        static_hash<mod_hash<L_N>>()
+    );
+
+    run_build_tests<string>(
+        "username_djb2", //
+        tests,
+        users,
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_djb2_hash<L_N>>()
+    );
+
+    // Perfect hash map built once vs lp and stl, build time and lookup latency
+    run_frozen_tests<uint64>(
+        "id_mod", //
+        tests,
+        users,
+        [](const User *user) { return user->id; },
+        static_hash<mod_hash<L_N>>()
+    );
+
+    run_frozen_tests<string>(
+        "username_djb2", //
+        tests,
+        users,
+        [](const User *user) { return string_view(user->username); },
+        static_hash<username_djb2_hash<L_N>>()
+    );
+
+    // Timestamp parsing of read_csv vs the stream based one it replaced
+    run_timestamp_tests("universities_followers.csv", tests);
+
+    // Raw speed of the hash functions themselves, no map involved
+    run_hash_tests(
+        "id", //
+        tests,
+        users,
+        [](const User *user) { return user->id; },
+        make_pair("mod", static_hash<mod_hash<L_N>>()),
+        make_pair("folding", static_hash<folding_hash<L_N>>()),
+        make_pair("std::hash", hash<uint64>()),
+        make_pair("murmur", static_hash<murmur_hash<L_N>>()),
+        make_pair("mulxor", static_hash<mulxor_hash<L_N>>())
+    );
+
+    run_hash_tests(
+        "username", //
+        tests,
+        users,
+        [](const User *user) { return string_view(user->username); },
+        make_pair("djb2", static_hash<username_djb2_hash<L_N>>()),
+        make_pair("sdbm", static_hash<username_sdbm_hash<L_N>>()),
+        make_pair("shifting", static_hash<username_shifting_hash<L_N>>()),
+        make_pair("std::hash", hash<string_view>()),
+        make_pair("wy", static_hash<username_wy_hash<L_N>>()),
+        make_pair("fixed16", [](string_view username) { return fixed_key16(username).hash(); })
     );
 
     cout << "\n==========================================================\n\n"
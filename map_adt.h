@@ -1,9 +1,21 @@
 #pragma once
 
+#include "memory.h"
+#include "parallel.h"
+
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <type_traits>
 #include <vector>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 using namespace std;
 
 /**
@@ -11,17 +23,250 @@ using namespace std;
  */
 template <typename K, typename V> class map_adt {
   public:
-    virtual V get(K key)             = 0;
-    virtual V put(K key, V value)    = 0;
-    virtual V remove(K key)          = 0;
-    virtual uint32 size()            = 0;
-    virtual bool empty()             = 0;
-    virtual void clear()             = 0;
-    virtual void rehash(uint32 size) = 0;
-    virtual vector<K> keys()         = 0;
-    virtual vector<V> values()       = 0;
+    virtual V get(const K &key)          = 0;
+    virtual V put(const K &key, V value) = 0;
+    virtual V remove(const K &key)       = 0;
+    virtual uint32 size()                = 0;
+    virtual bool empty()                 = 0;
+    virtual void clear()                 = 0;
+    virtual void rehash(uint32 size)     = 0;
+    virtual vector<K> keys()             = 0;
+    virtual vector<V> values()           = 0;
+};
+
+/** Hint the CPU to start loading the cache line holding `address`, doesn't wait for it */
+inline void prefetch(const void *address) {
+#ifdef _MSC_VER
+    _mm_prefetch((const char *)address, _MM_HINT_T0);
+#else
+    __builtin_prefetch(address);
+#endif
+}
+
+/**
+ * Statically dispatched counterpart of map_adt (CRTP)
+ * Generic code taking a `static_map<M, K, V> &` calls straight into M without going through the vtable,
+ * so the whole operation, hashing included, can be inlined
+ */
+template <typename Derived, typename K, typename V> class static_map {
+  private:
+    /** Amount of keys of a batch whose slots are prefetched before the first one of them is resolved */
+    constexpr static const uint32 BATCH_WINDOW = 16;
+
+    inline Derived *derived() {
+        return static_cast<Derived *>(this);
+    }
+
+  public:
+    /** `L` can be anything Derived accepts as a lookup key, see is_lookup_key */
+    template <typename L> inline V get(const L &key) {
+        return this->derived()->Derived::get(key);
+    }
+
+    inline V put(const K &key, V value) {
+        return this->derived()->Derived::put(key, value);
+    }
+
+    template <typename L> inline V remove(const L &key) {
+        return this->derived()->Derived::remove(key);
+    }
+
+    inline uint32 size() {
+        return this->derived()->Derived::size();
+    }
+
+    inline bool empty() {
+        return this->derived()->Derived::empty();
+    }
+
+    inline void clear() {
+        this->derived()->Derived::clear();
+    }
+
+    inline void rehash(uint32 size) {
+        this->derived()->Derived::rehash(size);
+    }
+
+    inline vector<K> keys() {
+        return this->derived()->Derived::keys();
+    }
+
+    inline vector<V> values() {
+        return this->derived()->Derived::values();
+    }
+
+    /**
+     * Call `callback(key, value)` for every stored pair, without allocating anything
+     * Derived provides begin() and end(), whose entries have `key` and `value` members
+     */
+    template <typename F> void for_each(F callback) {
+        for (const auto &entry : *this->derived())
+            callback(entry.key, entry.value);
+    }
+
+    /** Heap bytes the stored keys allocated on their own, outside of the map's tables (see key_heap_bytes) */
+    uint64 key_heap_usage() {
+        uint64 bytes = 0;
+        this->derived()->for_each([&bytes](const K &key, V) { bytes += key_heap_bytes(key); });
+        return bytes;
+    }
+
+    /**
+     * Get the values paired with `count` keys into `values`
+     * Keys are hashed and their slots prefetched BATCH_WINDOW at a time before any of them is probed,
+     * so the cache misses of a window overlap instead of stalling one after the other
+     * Derived provides prefetch_slots(key), returning a hash, and get_prefetched(key, hash)
+     */
+    template <typename L> void get_batch(const L *keys, V *values, uint32 count) {
+        uint64 hashes[BATCH_WINDOW];
+
+        for (uint32 start = 0; start < count; start += BATCH_WINDOW) {
+            const uint32 end = min(start + BATCH_WINDOW, count);
+
+            for (uint32 i = start; i < end; i++)
+                hashes[i - start] = this->derived()->prefetch_slots(keys[i]);
+
+            for (uint32 i = start; i < end; i++)
+                values[i] = this->derived()->get_prefetched(keys[i], hashes[i - start]);
+        }
+    }
+
+    /**
+     * Insert `count` key-value pairs
+     * Slots are prefetched like in get_batch, but the pairs are then inserted through put,
+     * since an insertion can resize the table and invalidate the hashes of the rest of the window
+     */
+    void put_batch(const K *keys, const V *values, uint32 count) {
+        for (uint32 start = 0; start < count; start += BATCH_WINDOW) {
+            const uint32 end = min(start + BATCH_WINDOW, count);
+
+            for (uint32 i = start; i < end; i++)
+                this->derived()->prefetch_slots(keys[i]);
+
+            for (uint32 i = start; i < end; i++)
+                this->derived()->Derived::put(keys[i], values[i]);
+        }
+    }
+};
+
+/**
+ * Whether a map keyed by `K` can be looked up with an `L` without constructing a K
+ * Either `L` is the key itself, or both `Hash` and `KeyEqual` declare `is_transparent` like std's functors do
+ */
+template <typename K, typename L, typename Hash, typename KeyEqual, typename = void>
+struct is_lookup_key : is_same<K, L> {};
+
+template <typename K, typename L, typename Hash, typename KeyEqual>
+struct is_lookup_key<K, L, Hash, KeyEqual, void_t<typename Hash::is_transparent, typename KeyEqual::is_transparent>>
+    : true_type {};
+
+/**
+ * Forward iterator over the occupied slots of an open addressing map, in table order
+ * `Map` has a `table` of `Slot`s, its `max_size` and `occupied(index)`, and befriends the iterator
+ * Entries are read-only, any put, remove or rehash invalidates it
+ */
+template <typename Map, typename Slot> class slot_iterator {
+  private:
+    const Map *map;
+    uint32 index;
+
+    /** Move forward until an occupied slot or the end of the table */
+    inline void skip_free() {
+        while (this->index < this->map->max_size && !this->map->occupied(this->index))
+            this->index++;
+    }
+
+  public:
+    typedef forward_iterator_tag iterator_category;
+    typedef Slot value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const Slot *pointer;
+    typedef const Slot &reference;
+
+    slot_iterator(const Map *map, uint32 index) : map(map), index(index) {
+        this->skip_free();
+    }
+
+    inline reference operator*() const {
+        return this->map->table[this->index];
+    }
+
+    inline pointer operator->() const {
+        return &this->map->table[this->index];
+    }
+
+    inline slot_iterator &operator++() {
+        this->index++;
+        this->skip_free();
+        return *this;
+    }
+
+    inline slot_iterator operator++(int) {
+        slot_iterator previous = *this;
+        ++*this;
+        return previous;
+    }
+
+    inline bool operator==(const slot_iterator &other) const {
+        return this->index == other.index;
+    }
+
+    inline bool operator!=(const slot_iterator &other) const {
+        return this->index != other.index;
+    }
+};
+
+/**
+ * Hash of the key of a slot, only kept when the map stores hashes (STORE_HASH), empty otherwise
+ * Slots derive from it, so with hashes off it takes no space (empty base)
+ */
+template <bool STORE_HASH> class slot_hash {
+  public:
+    /** Whether the slot may hold a key with this hash, always true when hashes aren't stored */
+    inline bool may_match(uint32) const {
+        return true;
+    }
+
+    inline void store_hash(uint32) {}
+};
+
+/** Hash stored next to the key, probes check it before comparing keys and rehashes reuse it */
+template <> class slot_hash<true> {
+  public:
+    uint32 hash = 0;
+
+    inline bool may_match(uint32 hash) const {
+        return this->hash == hash;
+    }
+
+    inline void store_hash(uint32 hash) {
+        this->hash = hash;
+    }
 };
 
+/**
+ * Stateless functor wrapping a hash function known at compile time
+ * Unlike a function pointer or std::function, calls through it can be inlined into the probe loop
+ * Transparent, any key the function accepts (e.g. string_view) can be hashed without a conversion to K
+ */
+template <auto hash_fn> class static_hash {
+  public:
+    typedef void is_transparent;
+
+    template <typename T> inline int operator()(const T &key) const {
+        return hash_fn(key);
+    }
+};
+
+/** Whether a hash functor can't be called, only an empty std::function can't */
+template <typename F> inline bool is_empty_fn(const F &) {
+    return false;
+}
+
+template <typename R, typename... A> inline bool is_empty_fn(const function<R(A...)> &fn) {
+    return fn == nullptr;
+}
+
 bool is_prime(uint32 n) {
     if (n < 3)
         return n == 2;
@@ -41,3 +286,91 @@ inline uint32 find_next_prime(uint32 n) {
         n++;
     return n;
 }
+
+/**
+ * Capacity policy that keeps table sizes prime
+ * Indexes are reduced with a modulo, which spreads even weak hashes but costs an integer division per op
+ */
+class prime_capacity {
+  private:
+    /** Current size of the table */
+    uint32 size = 1;
+
+  public:
+    /** Name to print in the maps information */
+    constexpr static const char *name = "prime";
+
+    /** Apply the smallest prime size that fits `size` slots and return it */
+    uint32 resize(uint32 size) {
+        this->size = find_next_prime(size);
+        return this->size;
+    }
+
+    /** Initial index of a hash */
+    inline uint32 index(uint32 hash) const {
+        return hash % this->size;
+    }
+
+    /** Bring an index that went past the end of the table back into it */
+    inline uint32 wrap(uint32 index) const {
+        return index % this->size;
+    }
+
+    /** Offset of the n-th quadratic probe */
+    inline uint32 quadratic(uint32 n) const {
+        return n * n;
+    }
+
+    /** Step of a double hashing probe sequence, never 0 and coprime with the size */
+    inline uint32 step(uint32 hash) const {
+        return this->size > 1 ? hash % (this->size - 1) + 1 : 1;
+    }
+};
+
+/**
+ * Capacity policy that keeps table sizes a power of two
+ * Indexes are reduced with a mask, the initial index goes through a Fibonacci multiply-shift first
+ * so weak hashes (e.g. a small modulo) still spread over the whole table
+ */
+class pow2_capacity {
+  private:
+    /** Size of the table minus one */
+    uint32 mask = 0;
+    /** Shift that keeps the top log2(size) bits of a 64-bit product */
+    uint32 shift = 63;
+
+  public:
+    /** Name to print in the maps information */
+    constexpr static const char *name = "pow2";
+
+    /** Apply the smallest power of two size that fits `size` slots and return it */
+    uint32 resize(uint32 size) {
+        uint32 bits = 1;
+        while (bits < 31 && (1u << bits) < size)
+            bits++;
+
+        this->mask  = (1u << bits) - 1;
+        this->shift = 64 - bits;
+        return this->mask + 1;
+    }
+
+    /** Initial index of a hash */
+    inline uint32 index(uint32 hash) const {
+        return (hash * 0x9E3779B97F4A7C15ull) >> this->shift;
+    }
+
+    /** Bring an index that went past the end of the table back into it */
+    inline uint32 wrap(uint32 index) const {
+        return index & this->mask;
+    }
+
+    /** Offset of the n-th quadratic probe, triangular numbers visit every slot of a power of two table */
+    inline uint32 quadratic(uint32 n) const {
+        return (uint64)n * (n + 1) / 2;
+    }
+
+    /** Step of a double hashing probe sequence, odd so it's coprime with the size */
+    inline uint32 step(uint32 hash) const {
+        return hash | 1;
+    }
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "user.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * Read-only memory mapping of a whole file
+ * The file's bytes are paged in by the OS as they're read, nothing is copied into the process
+ * Mapped for sequential access, the kernel reads ahead of the scan
+ */
+class mapped_file {
+  private:
+    /** First mapped byte, null for an empty file */
+    const char *bytes = nullptr;
+    /** Size of the file */
+    uint64 length = 0;
+#ifdef _WIN32
+    HANDLE file    = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+  public:
+    /** Maps `file_name`, exits if it can't be opened */
+    mapped_file(const char *file_name) {
+#ifdef _WIN32
+        this->file = CreateFileA(
+            file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr
+        );
+
+        LARGE_INTEGER size;
+        if (this->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(this->file, &size)) {
+            cerr << "could not open " << file_name << "." << endl;
+            exit(1);
+        }
+
+        this->length = size.QuadPart;
+        if (this->length == 0)
+            return;
+
+        this->mapping = CreateFileMappingA(this->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (this->mapping != nullptr)
+            this->bytes = (const char *)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        const int fd = open(file_name, O_RDONLY);
+
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            cerr << "could not open " << file_name << "." << endl;
+            exit(1);
+        }
+
+        this->length = info.st_size;
+
+        if (this->length > 0) {
+            void *address = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (address != MAP_FAILED) {
+                madvise(address, this->length, MADV_SEQUENTIAL);
+                this->bytes = (const char *)address;
+            }
+        }
+
+        // The mapping keeps the file alive on its own
+        close(fd);
+#endif
+
+        if (this->length > 0 && this->bytes == nullptr) {
+            cerr << "could not map " << file_name << "." << endl;
+            exit(1);
+        }
+    }
+
+    mapped_file(const mapped_file &) = delete;
+
+    /** Deconstructor, unmaps the file */
+    ~mapped_file() {
+#ifdef _WIN32
+        if (this->bytes != nullptr)
+            UnmapViewOfFile(this->bytes);
+        if (this->mapping != nullptr)
+            CloseHandle(this->mapping);
+        if (this->file != INVALID_HANDLE_VALUE)
+            CloseHandle(this->file);
+#else
+        if (this->bytes != nullptr)
+            munmap((void *)this->bytes, this->length);
+#endif
+    }
+
+    /** First byte of the file */
+    const char *data() const {
+        return this->bytes;
+    }
+
+    /** Size of the file */
+    uint64 size() const {
+        return this->length;
+    }
+
+    /** Every byte of the file */
+    string_view view() const {
+        return string_view(this->bytes, this->length);
+    }
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "user.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(_WIN32)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+
+using namespace std;
+
+/**
+ * Heap memory owned by a single map, fed by every allocation the map makes through tracked_malloc
+ * Blocks are counted by what the heap actually reserved for them, not by what was asked for
+ */
+class memory_stats {
+  private:
+    /** Bytes currently allocated */
+    uint64 live = 0;
+    /** Max amount of bytes that were allocated at the same time */
+    uint64 peak = 0;
+    /** Amount of blocks allocated so far */
+    uint64 allocation_count = 0;
+    /** Amount of blocks allocated and not freed yet */
+    uint64 live_count = 0;
+
+  public:
+    /** Record a block of `bytes` being allocated */
+    inline void allocated(uint64 bytes) {
+        this->live += bytes;
+        this->peak  = max(this->peak, this->live);
+        this->allocation_count++;
+        this->live_count++;
+    }
+
+    /** Record a block of `bytes` being freed */
+    inline void freed(uint64 bytes) {
+        this->live -= bytes;
+        this->live_count--;
+    }
+
+    /**
+     * Add up the memory of another map, e.g. of every shard of a sharded map
+     * The peak becomes the sum of both peaks, an upper bound since they may not have happened at the same time
+     */
+    memory_stats &operator+=(const memory_stats &other) {
+        this->live             += other.live;
+        this->peak             += other.peak;
+        this->allocation_count += other.allocation_count;
+        this->live_count       += other.live_count;
+        return *this;
+    }
+
+    /** Bytes currently allocated */
+    uint64 live_bytes() const {
+        return this->live;
+    }
+
+    /** Max amount of bytes that were allocated at the same time */
+    uint64 peak_bytes() const {
+        return this->peak;
+    }
+
+    /** Amount of blocks allocated so far */
+    uint64 allocations() const {
+        return this->allocation_count;
+    }
+
+    /** Amount of blocks allocated and not freed yet */
+    uint64 live_allocations() const {
+        return this->live_count;
+    }
+
+    /**
+     * Print the memory lines of a map's info
+     * `object_bytes` is the size of the map object itself, `payload_bytes` the bytes of the keys and values it holds
+     * and `key_bytes` the buffers its keys allocated on their own (see key_heap_bytes)
+     * Fragmentation is the share of the memory that holds no key or value: empty slots, spare capacity,
+     * metadata, links and heap overhead
+     */
+    void info(stringstream &out, uint64 object_bytes, uint64 payload_bytes, uint64 key_bytes) const {
+        const uint64 total = object_bytes + this->live + key_bytes;
+
+        out << "size in memory: " << total << " B (" << this->live << " B tables and nodes, " << key_bytes
+            << " B key buffers)\n"
+            << "peak memory: " << object_bytes + this->peak + key_bytes << " B\n"
+            << "allocations: " << this->allocation_count << " (" << this->live_count << " live)\n"
+            << "fragmentation: "
+            << 100 * (1 - (double)(payload_bytes + key_bytes) / max(total, (uint64)1)) << "%\n";
+    }
+};
+
+/**
+ * Bytes the heap reserved for a block, its usable size plus the chunk header where it's known
+ * Falls back to the requested size when the platform can't tell
+ */
+inline uint64 heap_block_bytes(void *ptr, uint64 requested) {
+#if defined(__GLIBC__)
+    (void)requested;
+    return malloc_usable_size(ptr) + sizeof(size_t);
+#elif defined(_WIN32)
+    (void)requested;
+    return _msize(ptr);
+#elif defined(__APPLE__)
+    (void)requested;
+    return malloc_size(ptr);
+#else
+    (void)ptr;
+    return requested;
+#endif
+}
+
+/** Allocate `bytes` from the heap, recorded in `stats` unless it's null */
+inline void *tracked_malloc(memory_stats *stats, uint64 bytes) {
+    void *ptr = malloc(max(bytes, (uint64)1));
+    if (ptr == nullptr)
+        throw bad_alloc();
+
+    if (stats != nullptr)
+        stats->allocated(heap_block_bytes(ptr, bytes));
+
+    return ptr;
+}
+
+/** Free a block allocated by tracked_malloc with the same `stats` */
+inline void tracked_free(memory_stats *stats, void *ptr, uint64 bytes) {
+    if (ptr == nullptr)
+        return;
+
+    if (stats != nullptr)
+        stats->freed(heap_block_bytes(ptr, bytes));
+
+    free(ptr);
+}
+
+/**
+ * Standard allocator that records everything it allocates in a memory_stats
+ * Follows its containers when they're moved or swapped, so a table moved out of a map still frees into its stats
+ * A default constructed one tracks nothing
+ */
+template <typename T> class tracking_allocator {
+  public:
+    typedef T value_type;
+    typedef true_type propagate_on_container_copy_assignment;
+    typedef true_type propagate_on_container_move_assignment;
+    typedef true_type propagate_on_container_swap;
+
+    static_assert(alignof(T) <= alignof(max_align_t), "malloc doesn't align T");
+
+    /** Where allocations are recorded */
+    memory_stats *stats = nullptr;
+
+    tracking_allocator() {}
+
+    tracking_allocator(memory_stats *stats) : stats(stats) {}
+
+    template <typename U> tracking_allocator(const tracking_allocator<U> &other) : stats(other.stats) {}
+
+    T *allocate(size_t n) {
+        return (T *)tracked_malloc(this->stats, n * sizeof(T));
+    }
+
+    void deallocate(T *ptr, size_t n) {
+        tracked_free(this->stats, ptr, n * sizeof(T));
+    }
+
+    template <typename U> bool operator==(const tracking_allocator<U> &other) const {
+        return this->stats == other.stats;
+    }
+
+    template <typename U> bool operator!=(const tracking_allocator<U> &other) const {
+        return this->stats != other.stats;
+    }
+};
+
+/** Vector whose buffer is recorded in a memory_stats */
+template <typename T> using tracked_vector = vector<T, tracking_allocator<T>>;
+
+/**
+ * Bytes a key allocated on its own, outside of the map's tables
+ * Only strings longer than their inline buffer have one, the rest of the keys live inside the slots
+ */
+template <typename K> inline uint64 key_heap_bytes(const K &) {
+    return 0;
+}
+
+template <typename C, typename T, typename A> inline uint64 key_heap_bytes(const basic_string<C, T, A> &key) {
+    const char *data   = (const char *)key.data();
+    const char *object = (const char *)&key;
+
+    // Short strings keep their characters inside the object
+    if (data >= object && data < object + sizeof(key))
+        return 0;
+
+    return (key.capacity() + 1) * sizeof(C);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "memory.h"
+#include "user.h"
+
+#include <new>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Node allocator policy that gets every node straight from the heap
+ */
+template <typename T> class heap_allocator {
+  private:
+    /** Where the nodes are recorded, the memory of the map owning the allocator */
+    memory_stats *memory;
+    /** Amount of times the heap was asked for memory */
+    uint64 allocations = 0;
+
+  public:
+    /** Name to print in the maps information */
+    constexpr static const char *name = "heap";
+
+    heap_allocator(memory_stats *memory) : memory(memory) {}
+
+    /** Allocate and construct a node */
+    template <typename... A> inline T *create(A &&...args) {
+        this->allocations++;
+        return new (tracked_malloc(this->memory, sizeof(T))) T(forward<A>(args)...);
+    }
+
+    /** Destruct and free a node */
+    inline void destroy(T *node) {
+        node->~T();
+        tracked_free(this->memory, node, sizeof(T));
+    }
+
+    /** Amount of times the heap was asked for memory */
+    uint64 heap_allocations() const {
+        return this->allocations;
+    }
+};
+
+/**
+ * Node allocator policy that carves nodes out of slabs of `SLAB_SIZE` nodes
+ * Freed nodes are recycled through an intrusive free list stored in the nodes themselves,
+ * so the heap is only hit once per slab and nodes allocated together end up next to each other
+ * All memory is given back when the pool is destroyed
+ */
+template <typename T, uint32 SLAB_SIZE = 1024> class pool_allocator {
+  private:
+    /** Storage of a node, reused as a link of the free list while it's not in use */
+    union pool_slot {
+        pool_slot *next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    /** Where the slabs are recorded, the memory of the map owning the allocator */
+    memory_stats *memory;
+    /** Every slab allocated so far */
+    tracked_vector<pool_slot *> slabs;
+    /** Head of the list of freed slots */
+    pool_slot *free_list = nullptr;
+    /** Slots of the last slab that were never handed out yet */
+    uint32 slab_remaining = 0;
+
+  public:
+    /** Name to print in the maps information */
+    constexpr static const char *name = "pool";
+
+    pool_allocator(memory_stats *memory) : memory(memory), slabs(memory) {}
+
+    pool_allocator(const pool_allocator &) = delete;
+
+    /** Deconstructor, frees every slab */
+    ~pool_allocator() {
+        for (pool_slot *slab : this->slabs)
+            tracked_free(this->memory, slab, SLAB_SIZE * sizeof(pool_slot));
+    }
+
+    /** Allocate and construct a node, reusing a freed slot when possible */
+    template <typename... A> inline T *create(A &&...args) {
+        pool_slot *slot = this->free_list;
+
+        if (slot != nullptr) {
+            this->free_list = slot->next;
+        } else {
+            if (this->slab_remaining == 0) {
+                this->slabs.push_back((pool_slot *)tracked_malloc(this->memory, SLAB_SIZE * sizeof(pool_slot)));
+                this->slab_remaining = SLAB_SIZE;
+            }
+
+            slot = &this->slabs.back()[SLAB_SIZE - this->slab_remaining--];
+        }
+
+        return new (slot->storage) T(forward<A>(args)...);
+    }
+
+    /** Destruct a node and push its slot to the free list */
+    inline void destroy(T *node) {
+        node->~T();
+
+        pool_slot *slot = reinterpret_cast<pool_slot *>(node);
+        slot->next      = this->free_list;
+        this->free_list = slot;
+    }
+
+    /** Amount of times the heap was asked for memory */
+    uint64 heap_allocations() const {
+        return this->slabs.size();
+    }
+};
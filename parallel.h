@@ -0,0 +1,21 @@
+#pragma once
+
+#include "user.h"
+
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/** Run `task(t)` for every t in [0, threads) on its own thread, the calling thread runs the first one */
+template <typename F> void parallel_for(uint32 threads, F task) {
+    vector<thread> workers;
+
+    for (uint32 t = 1; t < threads; t++)
+        workers.emplace_back(task, t);
+
+    task(0);
+
+    for (thread &worker : workers)
+        worker.join();
+}
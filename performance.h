@@ -35,3 +35,16 @@ class performance {
         return chrono::duration_cast<D>(system_clock::now() - this->_start).count();
     }
 };
+
+/**
+ * Keep the compiler from optimizing away a value that's only computed to be measured
+ * Once a map operation is fully inlined, an unused result would let the whole lookup be dropped
+ */
+template <typename T> inline void do_not_optimize(const T &value) {
+#ifdef _MSC_VER
+    volatile T sink = value;
+    (void)sink;
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "map_adt.h"
+#include "memory.h"
 
 #include <cstdlib>
 #include <functional>
@@ -13,126 +14,239 @@ using namespace std;
 
 /**
  * Quadratic Probing Hash Map
+ * With `STORE_HASH` every slot keeps the hash of its key, see slot_hash
  */
-template <typename K, typename V> class qp_hash_map : virtual public map_adt<K, V> {
+template <typename K, typename V, typename Capacity = prime_capacity, typename Hash = function<int(K)>,
+          typename KeyEqual = equal_to<K>, bool STORE_HASH = false>
+class qp_hash_map : virtual public map_adt<K, V>,
+                    public static_map<qp_hash_map<K, V, Capacity, Hash, KeyEqual, STORE_HASH>, K, V> {
   private:
+    friend class static_map<qp_hash_map, K, V>;
+
     /**
-     * key-value pair node
+     * key-value pair slot
+     * Stored inline in the table, so probing never leaves its memory
      */
-    class hash_node {
+    class hash_slot : public slot_hash<STORE_HASH> {
       public:
         K key;
         V value;
-
-        hash_node(K key, V value) : key(key), value(value) {}
     };
 
+    friend class slot_iterator<qp_hash_map, hash_slot>;
+
+    /** Occupancy state of a slot, DELETED slots are tombstones that keep probe sequences going */
+    enum slot_state : uint8 { EMPTY, FULL, DELETED };
+
     /** Target load factor */
     constexpr static const double LOAD_FACTOR_THRESHOLD = 0.75;
 
+    /** Policy deciding the size of the table and how hashes are reduced to indexes */
+    Capacity capacity;
     /** Max size of the table */
     uint32 max_size;
     /** Size threshold at which the table should be rehashed */
     uint32 size_threshold;
-    /** Table where all the nodes reside */
-    vector<hash_node *> table;
+    /** Heap memory held by the map, every table is allocated through it */
+    memory_stats memory;
+    /** Table where all the slots reside */
+    tracked_vector<hash_slot> table;
+    /** Occupancy state of each slot, kept apart so probes only touch a byte per slot */
+    tracked_vector<uint8> states;
     /** Current size of the table */
     uint32 current_size = 0;
+    /** Amount of DELETED slots */
+    uint32 tombstones = 0;
     /** Hash function to calculate the initial index to insert the value at */
-    function<int(K)> hash_fn;
+    Hash hash_fn;
+    /** Key equality, compared on every probed candidate */
+    KeyEqual key_equal;
+
+    /**
+     * Find the index of the slot holding the key, or max_size if there's none
+     * Stops at the first empty slot, tombstones are skipped over
+     */
+    template <typename L> uint32 find(const L &key) {
+        return this->find(key, this->hash_fn(key));
+    }
+
+    /** Find with the already calculated hash of the key */
+    template <typename L> uint32 find(const L &key, uint32 hash) {
+        const uint32 hash_index = this->capacity.index(hash);
+        uint32 index            = hash_index;
+        uint32 counter          = 0;
+
+        while (counter < this->max_size && this->states[index] != EMPTY) {
+            if (this->states[index] == FULL && this->table[index].may_match(hash)
+                && this->key_equal(this->table[index].key, key))
+                return index;
+
+            counter++;
+            index = this->capacity.wrap(hash_index + this->capacity.quadratic(counter));
+        }
+
+        return this->max_size;
+    }
+
+    /** Hash of the key of an occupied slot, read back from the slot when hashes are stored */
+    inline uint32 hash_of(const hash_slot &slot) {
+        if constexpr (STORE_HASH) {
+            return slot.hash;
+        } else {
+            return this->hash_fn(slot.key);
+        }
+    }
+
+    /**
+     * Insert a key that isn't in the map yet into the first free slot of its probe sequence
+     * Only used while rehashing, the new table has no tombstones
+     */
+    void insert_absent(K &&key, V value, uint32 hash) {
+        const uint32 hash_index = this->capacity.index(hash);
+        uint32 index            = hash_index;
+        uint32 counter          = 0;
+
+        while (counter < this->max_size && this->states[index] != EMPTY) {
+            counter++;
+            index = this->capacity.wrap(hash_index + this->capacity.quadratic(counter));
+        }
+
+        if (counter == this->max_size) {
+            cout << "[qp] probe sequence is full, rehashing" << endl;
+            this->rehash(this->max_size * 2);
+            this->insert_absent(move(key), value, hash);
+            return;
+        }
+
+        hash_slot &slot = this->table[index];
+        slot.key        = move(key);
+        slot.value      = value;
+        slot.store_hash(hash);
+        this->states[index] = FULL;
+        this->current_size++;
+    }
+
+    /** Start loading the home slot of a key into cache, returns the hash get_prefetched resolves it with */
+    template <typename L> uint64 prefetch_slots(const L &key) {
+        const uint32 hash  = this->hash_fn(key);
+        const uint32 index = this->capacity.index(hash);
+        prefetch(&this->states[index]);
+        prefetch(&this->table[index]);
+        return hash;
+    }
+
+    /** Get the value paired with a key whose slots were already prefetched */
+    template <typename L> V get_prefetched(const L &key, uint64 hash) {
+        const uint32 index = this->find(key, hash);
+        return index != this->max_size ? this->table[index].value : nullptr;
+    }
+
+    /** Whether a slot holds a key-value pair */
+    inline bool occupied(uint32 index) const {
+        return this->states[index] == FULL;
+    }
 
   public:
     /** Constructor that takes the hash function as a parameter */
-    qp_hash_map(uint32 initial_size, function<int(K)> hash_fn)
-        : max_size(initial_size), size_threshold(initial_size * LOAD_FACTOR_THRESHOLD), table(initial_size, nullptr),
-          hash_fn(hash_fn) {
-        if (hash_fn == nullptr) {
+    qp_hash_map(uint32 initial_size, Hash hash_fn = Hash())
+        : max_size(capacity.resize(initial_size)), size_threshold(max_size * LOAD_FACTOR_THRESHOLD),
+          table(max_size, &memory), states(max_size, EMPTY, &memory), hash_fn(hash_fn) {
+        if (is_empty_fn(this->hash_fn)) {
             cerr << "hash_fn cannot be null." << endl;
             exit(1);
         }
     }
 
-    /** Deconstructor, frees allocated memory */
-    ~qp_hash_map() {
-        this->clear();
-    }
+    /** Deconstructor, slots are owned by the table */
+    ~qp_hash_map() {}
 
     /** Get the value paired with the key */
-    V get(K key) {
-        const int index = this->hash_fn(key) % this->max_size;
-        uint32 counter  = 0;
-
-        hash_node *node = this->table[index];
-
-        // Stop once we run through the entire table or find a match
-        while (counter <= this->max_size && (node != nullptr ? node->key != key : true)) {
-            counter++;
-            const int new_index = (index + (counter * counter)) % this->max_size;
-            node                = this->table[new_index];
-        }
+    V get(const K &key) {
+        return this->template get<K>(key);
+    }
 
-        return node != nullptr ? node->value : nullptr;
+    /** Get the value paired with a lookup key, e.g. a string_view for string keys (see is_lookup_key) */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V get(const L &key) {
+        const uint32 index = this->find(key);
+        return index != this->max_size ? this->table[index].value : nullptr;
     }
 
     /** Insert a key-value pair */
-    V put(K key, V value) {
-        if (this->current_size >= this->size_threshold) {
+    V put(const K &key, V value) {
+        if (this->current_size + this->tombstones >= this->size_threshold) {
             cout << "[qp] passed load factor threshold, rehashing" << endl;
-            this->rehash(this->current_size * 2);
+            // Mostly tombstones -> clean them up in a table of the same size
+            this->rehash(this->current_size >= this->size_threshold / 2 ? this->current_size * 2 : this->max_size);
         }
 
-        const int hash_index = this->hash_fn(key) % this->max_size;
-        int insert_index     = hash_index;
-        int counter          = 0;
+        const uint32 hash       = this->hash_fn(key);
+        const uint32 hash_index = this->capacity.index(hash);
+        uint32 index            = hash_index;
+        uint32 free_index       = this->max_size;
+        uint32 counter          = 0;
 
-        hash_node *node = this->table[hash_index];
+        // Stop once we find an empty slot or a match, remembering the first tombstone on the way
+        while (counter < this->max_size && this->states[index] != EMPTY
+               && (this->states[index] == DELETED || !this->table[index].may_match(hash)
+                   || !this->key_equal(this->table[index].key, key))) {
+            if (this->states[index] == DELETED && free_index == this->max_size)
+                free_index = index;
 
-        // Stop once we find an empty node or a match
-        while (node != nullptr && node->key != key) {
             counter++;
-            insert_index = (hash_index + (counter * counter)) % this->max_size;
-            node         = this->table[insert_index];
+            index = this->capacity.wrap(hash_index + this->capacity.quadratic(counter));
         }
 
-        // Found empty node
-        if (node == nullptr) {
-            this->table[insert_index] = new hash_node(key, value);
-            this->current_size++;
-            return nullptr;
+        // Match -> override value
+        if (counter < this->max_size && this->states[index] == FULL) {
+            V previous_value         = this->table[index].value;
+            this->table[index].value = value;
+            return previous_value;
         }
 
-        // Match -> override value
-        V previous_value = node->value;
-        node->value      = value;
+        if (free_index != this->max_size) {
+            // Reuse the first tombstone
+            this->tombstones--;
+        } else if (counter < this->max_size) {
+            // Found empty slot
+            free_index = index;
+        } else {
+            cout << "[qp] probe sequence is full, rehashing" << endl;
+            this->rehash(this->max_size * 2);
+            return this->put(key, value);
+        }
 
-        return previous_value;
+        hash_slot &slot = this->table[free_index];
+        slot.key        = key;
+        slot.value      = value;
+        slot.store_hash(hash);
+        this->states[free_index] = FULL;
+        this->current_size++;
+
+        return nullptr;
     }
 
-    /** Remove a key-value pair by it's key */
-    V remove(K key) {
-        const int hash_index = this->hash_fn(key) % this->max_size;
-        int value_index      = hash_index;
-        uint32 counter       = 0;
+    /** Remove a key-value pair by it's key, leaving a tombstone behind */
+    V remove(const K &key) {
+        return this->template remove<K>(key);
+    }
 
-        hash_node *node = this->table[hash_index];
-
-        // Stop once we run through the entire table or find a match
-        while (counter <= this->max_size && (node != nullptr ? node->key != key : true)) {
-            counter++;
-            value_index = (hash_index + (counter * counter)) % this->max_size;
-            node        = this->table[value_index];
-        }
+    /** Remove a key-value pair by a lookup key */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V remove(const L &key) {
+        const uint32 index = this->find(key);
 
         // No match
-        if (node == nullptr)
+        if (index == this->max_size)
             return nullptr;
 
-        // Match -> delete node
-        V value = node->value;
+        // Match -> tombstone
+        V value = this->table[index].value;
 
-        this->table[value_index] = nullptr;
-        delete node;
+        this->table[index]  = hash_slot();
+        this->states[index] = DELETED;
         this->current_size--;
+        this->tombstones++;
 
         return value;
     }
@@ -147,45 +261,60 @@ template <typename K, typename V> class qp_hash_map : virtual public map_adt<K,
         return this->current_size == 0;
     }
 
-    /** Clear the map - frees allocated memory */
+    /** Clear the map - resets every slot but keeps the table's capacity */
     void clear() {
         for (uint32 i = 0; i < this->max_size; i++) {
-            hash_node *node = this->table[i];
-            if (node == nullptr)
+            if (this->states[i] == EMPTY)
                 continue;
 
-            this->table[i] = nullptr;
-            delete node;
+            this->table[i]  = hash_slot();
+            this->states[i] = EMPTY;
         }
 
         this->current_size = 0;
+        this->tombstones   = 0;
     }
 
     /**
      * Rehash table for new target size
-     * If the size isn't a prime, the next prime is selected
+     * The size is rounded up by the capacity policy (next prime or power of two)
      * Very costly operation, can be avoided by choosing an appropriate initial size
      * Can also end up being recursive if there's integer overflow
+     * Keys aren't hashed again when hashes are stored
      */
     void rehash(uint32 size) {
         // Move, don't copy
-        vector<hash_node *> nodes = move(this->table);
+        tracked_vector<hash_slot> slots = move(this->table);
+        tracked_vector<uint8> states    = move(this->states);
 
-        for (uint32 i = 0; i < this->max_size; i++) {
-            this->table[i] = nullptr;
+        // Calculate new size and apply
+        const uint32 new_size = this->capacity.resize(size);
+        this->table           = tracked_vector<hash_slot>(new_size, &this->memory);
+        this->states          = tracked_vector<uint8>(new_size, EMPTY, &this->memory);
+        this->current_size    = 0;
+        this->tombstones      = 0;
+        this->max_size        = new_size;
+        this->size_threshold  = new_size * LOAD_FACTOR_THRESHOLD;
+
+        // Reinsert slots, keys are already known to be unique
+        for (uint32 i = 0; i < slots.size(); i++) {
+            if (states[i] == FULL) {
+                const uint32 hash = this->hash_of(slots[i]);
+                this->insert_absent(move(slots[i].key), slots[i].value, hash);
+            }
         }
+    }
 
-        // Calculate new size and apply
-        const uint32 new_size = find_next_prime(size);
-        this->table.resize(new_size);
-        this->current_size   = 0;
-        this->max_size       = new_size;
-        this->size_threshold = new_size * LOAD_FACTOR_THRESHOLD;
+    /** Read-only forward iterator over the stored pairs, invalidated by any put, remove or rehash */
+    typedef slot_iterator<qp_hash_map, hash_slot> iterator;
+
+    /** Iterator to the first stored pair, pairs are visited in table order */
+    iterator begin() const {
+        return iterator(this, 0);
+    }
 
-        // Reinsert nodes
-        for (hash_node *node : nodes)
-            if (node != nullptr)
-                this->put(node->key, node->value);
+    iterator end() const {
+        return iterator(this, this->max_size);
     }
 
     /**
@@ -194,10 +323,10 @@ template <typename K, typename V> class qp_hash_map : virtual public map_adt<K,
      */
     vector<K> keys() {
         vector<K> result;
+        result.reserve(this->current_size);
 
-        for (hash_node *node : this->table)
-            if (node != nullptr)
-                result.push_back(node->key);
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.key);
 
         return result;
     }
@@ -208,25 +337,29 @@ template <typename K, typename V> class qp_hash_map : virtual public map_adt<K,
      */
     vector<V> values() {
         vector<V> result;
+        result.reserve(this->current_size);
 
-        for (hash_node *node : this->table)
-            if (node != nullptr)
-                result.push_back(node->value);
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.value);
 
         return result;
     }
 
+    /** Heap memory held by the map */
+    const memory_stats &heap_usage() const {
+        return this->memory;
+    }
+
     /** Print information about the hash map */
     void info(stringstream &out) {
         out << "[qp] map info:\n"
-            << "max size: " << this->max_size << "\n"
+            << "max size: " << this->max_size << " (" << Capacity::name << ")\n"
             << "size: " << this->current_size << "\n"
+            << "tombstones: " << this->tombstones << "\n"
             << "load factor: " << (double)this->current_size / this->max_size << "\n"
-            << "size in memory: "
-            << sizeof(*this)
-                   + this->current_size
-                         * (sizeof(hash_node *) + sizeof(hash_node) + (is_pointer<V>::value ? sizeof(*(V){nullptr}) : 0))
-            << " B\n"
-            << endl;
+            << "stored hashes: " << (STORE_HASH ? "yes" : "no") << "\n";
+
+        this->memory.info(out, sizeof(*this), this->current_size * (sizeof(K) + sizeof(V)), this->key_heap_usage());
+        out << endl;
     }
 };
@@ -1,88 +1,569 @@
 #pragma once
 
+#include "mapped_file.h"
+#include "parallel.h"
+#include "performance.h"
 #include "user.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
-#include <fstream>
-#include <iomanip>
 #include <iostream>
-#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
-#ifdef _WIN32
-#define timegm _mkgmtime
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define READ_CSV_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
 #endif
 
 using namespace std;
 
 typedef unordered_map<uint64, User *> user_map;
 
-/** Parse timestamp string into a time_t (int64) */
-time_t string_to_time(const string &field) {
-    istringstream input(field);
-    tm result;
-    input >> get_time(&result, "%a %b %d %H:%M:%S +0000 %Y");
-    return timegm(&result);
+/** Days from 1970-01-01 to a date of the proleptic Gregorian calendar (days from civil, by Howard Hinnant) */
+constexpr int64_t days_from_civil(int64_t year, uint32 month, uint32 day) {
+    // Years start in March, so the leap day is the last one of the year
+    year -= month <= 2;
+    const int64_t era        = (year >= 0 ? year : year - 399) / 400;
+    const uint32 year_of_era = year - era * 400;
+    const uint32 day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const uint32 day_of_era  = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
 }
 
-/** Read the entire CSV file */
-vector<const User *> read_csv(const char *file_name) {
-    cout << "reading .csv" << endl;
+/** Value of the `count` decimal digits at `digits`, or -1 if any of them isn't a digit */
+inline int32_t parse_digits(const char *digits, uint32 count) {
+    int32_t value = 0;
+    bool valid    = true;
 
-    ifstream csv(file_name);
-    // Store all users in a hash map for ~O(1) lookup
-    user_map users;
-    string row;
+    for (uint32 i = 0; i < count; i++) {
+        const uint32 digit  = (uint8)digits[i] - '0';
+        valid              &= digit <= 9;
+        value               = value * 10 + digit;
+    }
 
-    // remove first line
-    getline(csv, row);
+    return valid ? value : -1;
+}
 
-    while (!csv.eof()) {
-        getline(csv, row);
+/**
+ * Parse a timestamp in the fixed format "%a %b %d %H:%M:%S %z %Y" into a time_t (int64)
+ * e.g. "Thu Jul 28 07:16:49 +0000 2016", every field is at a fixed offset so nothing is searched for
+ * Doesn't use streams, locales or libc's time functions, returns 0 if the field doesn't match the format
+ */
+time_t string_to_time(string_view field) {
+    // Month names packed as 3 bytes, compared in one go
+    constexpr static const uint32 MONTHS[12] = {
+        'J' << 16 | 'a' << 8 | 'n', 'F' << 16 | 'e' << 8 | 'b', 'M' << 16 | 'a' << 8 | 'r', 'A' << 16 | 'p' << 8 | 'r',
+        'M' << 16 | 'a' << 8 | 'y', 'J' << 16 | 'u' << 8 | 'n', 'J' << 16 | 'u' << 8 | 'l', 'A' << 16 | 'u' << 8 | 'g',
+        'S' << 16 | 'e' << 8 | 'p', 'O' << 16 | 'c' << 8 | 't', 'N' << 16 | 'o' << 8 | 'v', 'D' << 16 | 'e' << 8 | 'c',
+    };
 
-        if (!csv.good())
-            break;
+    if (field.size() != 30)
+        return 0;
 
-        // Separate columns into an array of strings
-        string fields[7];
-        int i = 0;
+    const char *text  = field.data();
+    const uint32 name = (uint8)text[4] << 16 | (uint8)text[5] << 8 | (uint8)text[6];
+    uint32 month      = 0;
 
-        for (const char c : row) {
-            switch (c) {
-                case ',': i++; break;
-                default:  fields[i] += c; break;
-            }
+    for (uint32 i = 0; i < 12; i++)
+        month = MONTHS[i] == name ? i + 1 : month;
+
+    const int32_t day     = parse_digits(text + 8, 2);
+    const int32_t hours   = parse_digits(text + 11, 2);
+    const int32_t minutes = parse_digits(text + 14, 2);
+    const int32_t seconds = parse_digits(text + 17, 2);
+    const int32_t offset  = parse_digits(text + 21, 4);
+    const int32_t year    = parse_digits(text + 26, 4);
+
+    if (month == 0 || (day | hours | minutes | seconds | offset | year) < 0 || (text[20] != '+' && text[20] != '-'))
+        return 0;
+
+    // UTC offset as +hhmm or -hhmm, the local time is ahead of UTC by it
+    const int32_t offset_seconds = (offset / 100 * 3600 + offset % 100 * 60) * (text[20] == '-' ? -1 : 1);
+
+    return days_from_civil(year, month, day) * 86400 + hours * 3600 + minutes * 60 + seconds - offset_seconds;
+}
+
+/**
+ * Splits CSV bytes at every ',' and '\n', 16 bytes at a time
+ * Each block is compared against both delimiters at once and the matches are kept as a bitmask,
+ * so consecutive short fields are handed out from the same mask without scanning again
+ */
+class csv_tokenizer {
+  private:
+    /** Bytes per scanned block, one SSE2 register */
+    constexpr static const uint32 BLOCK_SIZE = 16;
+
+    /** Block the mask belongs to */
+    const char *block;
+    /** End of the bytes */
+    const char *end;
+    /** Delimiters of the block that weren't handed out yet, bit i is block[i] */
+    uint32 mask;
+    /** Start of the row next_row reads */
+    const char *next_start;
+
+    /** Index of the lowest set bit */
+    static inline uint32 count_trailing_zeros(uint32 mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    /** Bitmask of the delimiters of the block starting at `bytes` */
+    inline uint32 scan(const char *bytes) const {
+        const uint32 available = this->end - bytes;
+        uint32 mask            = 0;
+
+#ifdef READ_CSV_USE_SSE2
+        // A full load could run past the end of the mapping, the last partial block is scanned a byte at a time
+        if (available >= BLOCK_SIZE) {
+            const __m128i chunk  = _mm_loadu_si128((const __m128i *)bytes);
+            const __m128i commas = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(','));
+            const __m128i lines  = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'));
+            return _mm_movemask_epi8(_mm_or_si128(commas, lines));
+        }
+#endif
+
+        for (uint32 i = 0; i < min(available, BLOCK_SIZE); i++)
+            if (bytes[i] == ',' || bytes[i] == '\n')
+                mask |= 1u << i;
+
+        return mask;
+    }
+
+  public:
+    csv_tokenizer(const char *begin, const char *end)
+        : block(begin), end(end), mask(begin < end ? scan(begin) : 0), next_start(begin) {}
+
+    /** Position of the next delimiter, or the end of the bytes if there are no more */
+    inline const char *next() {
+        while (this->mask == 0) {
+            this->block += BLOCK_SIZE;
+            if (this->block >= this->end)
+                return this->end;
+
+            this->mask = this->scan(this->block);
+        }
+
+        const char *delimiter = this->block + count_trailing_zeros(this->mask);
+        this->mask &= this->mask - 1;
+        return delimiter;
+    }
+
+    /**
+     * Read the fields of the next row into `fields`, returns how many it had or 0 at the end of the bytes
+     * Fields past `count` are skipped, a trailing '\r' is dropped
+     */
+    uint32 next_row(string_view *fields, uint32 count) {
+        const char *start = this->next_start;
+        if (start >= this->end)
+            return 0;
+
+        uint32 found = 0;
+
+        while (true) {
+            const char *delimiter = this->next();
+
+            if (found < count)
+                fields[found] = string_view(start, delimiter - start);
+            found++;
+
+            start = delimiter + 1;
+            if (delimiter == this->end || *delimiter == '\n')
+                break;
         }
 
+        this->next_start = start;
+
+        string_view &last = fields[min(found, count) - 1];
+        if (!last.empty() && last.back() == '\r')
+            last.remove_suffix(1);
+
+        return found;
+    }
+};
+
+/** Copy a field into `buffer` as a null terminated string, cut to the buffer's size */
+template <size_t N> inline const char *terminated(string_view field, char (&buffer)[N]) {
+    const size_t length = min(field.size(), N - 1);
+    memcpy(buffer, field.data(), length);
+    buffer[length] = 0;
+    return buffer;
+}
+
+/** Parse a whole field as an unsigned integer, false if it has anything else or doesn't fit */
+template <typename T> inline bool parse_uint(string_view field, T &value) {
+    const char *end                = field.data() + field.size();
+    const from_chars_result result = from_chars(field.data(), end, value);
+    return result.ec == errc() && result.ptr == end;
+}
+
+/**
+ * Parse a user id, either plain digits or the scientific notation spreadsheets write big ids in,
+ * e.g. 7.58561835897479E+017
+ * Scientific ids are decoded exactly from their digits, without going through floating point
+ * The notation keeps about 15 significant digits, the dropped ones are read as zeros and `range` is set to how many
+ * ids the field could stand for, [id, id + range). It's 1 when the id is exact
+ * Returns false if the field isn't a whole id that fits in 64 bits
+ */
+inline bool parse_id(string_view field, uint64 &id, uint64 &range) {
+    range = 1;
+
+    const size_t exponent_at = field.find_first_of("eE");
+    if (exponent_at == string_view::npos)
+        return parse_uint(field, id);
+
+    // Mantissa digits as an integer, and how many of them come after the point
+    const string_view mantissa = field.substr(0, exponent_at);
+    const size_t point         = mantissa.find('.');
+    uint64 digits              = 0;
+    int32_t fraction_digits    = 0;
+
+    if (point == string_view::npos) {
+        if (!parse_uint(mantissa, digits))
+            return false;
+    } else {
+        const string_view integer = mantissa.substr(0, point), fraction = mantissa.substr(point + 1);
+        uint64 integer_digits = 0, fraction_value = 0;
+
+        if (integer.empty() || fraction.size() >= 20 || !parse_uint(integer, integer_digits)
+            || (!fraction.empty() && !parse_uint(fraction, fraction_value)))
+            return false;
+
+        fraction_digits = fraction.size();
+        if (integer_digits > (UINT64_MAX - fraction_value) / POWERS_OF_10[fraction_digits])
+            return false;
+
+        digits = integer_digits * POWERS_OF_10[fraction_digits] + fraction_value;
+    }
+
+    // from_chars takes a '-' but not a '+'
+    string_view exponent_text = field.substr(exponent_at + 1);
+    if (!exponent_text.empty() && exponent_text[0] == '+')
+        exponent_text.remove_prefix(1);
+
+    int32_t exponent;
+    const char *exponent_end = exponent_text.data() + exponent_text.size();
+    const from_chars_result result = from_chars(exponent_text.data(), exponent_end, exponent);
+    if (result.ec != errc() || result.ptr != exponent_end || exponent < -40 || exponent > 40)
+        return false;
+
+    int32_t shift = exponent - fraction_digits;
+
+    // Fewer digits than the point was moved by -> the last ones must be zeros, or it isn't an integer
+    for (; shift < 0; shift++) {
+        if (digits % 10 != 0)
+            return false;
+
+        digits /= 10;
+    }
+
+    if (shift >= 20 || (digits != 0 && digits > UINT64_MAX / POWERS_OF_10[shift]))
+        return false;
+
+    id    = digits * POWERS_OF_10[shift];
+    range = POWERS_OF_10[shift];
+    return true;
+}
+
+/** What read_csv went through */
+class csv_stats {
+  public:
+    /** Bytes of rows, without the header */
+    uint64 bytes = 0;
+    /** Rows read */
+    uint64 rows = 0;
+    /** Rows skipped for missing fields or fields that aren't numbers */
+    uint64 malformed_rows = 0;
+    /** Rows whose id was written in scientific notation that dropped some of its digits */
+    uint64 ambiguous_rows = 0;
+    /** Users read */
+    uint64 users = 0;
+    /** Users with an ambiguous id (see User::ambiguous_id) */
+    uint64 ambiguous_users = 0;
+    /** Users with an ambiguous id that took another id of its range, because another user already had it */
+    uint64 split_users = 0;
+    /** Users with an ambiguous id left with the id of another user, every id of its range was taken */
+    uint64 duplicate_ids = 0;
+    /** Time spent reading, in ns */
+    int64_t nanoseconds = 0;
+
+    /** Add up the stats of another chunk of the file */
+    csv_stats &operator+=(const csv_stats &other) {
+        this->bytes          += other.bytes;
+        this->rows           += other.rows;
+        this->malformed_rows += other.malformed_rows;
+        this->ambiguous_rows += other.ambiguous_rows;
+        return *this;
+    }
+
+    /** Print the stats */
+    void info(ostream &out) const {
+        const double seconds = max(this->nanoseconds, (int64_t)1) / 1e9;
+
+        out << "[csv] " << this->rows << " rows (" << this->malformed_rows << " malformed), " << this->users
+            << " users, " << this->bytes << " B in " << this->nanoseconds / 1e6
+            << " ms: " << this->bytes / seconds / 1e6 << " MB/s, " << this->rows / seconds / 1e6 << " M rows/s\n"
+            << "[csv] " << this->ambiguous_rows << " rows with ambiguous ids, " << this->ambiguous_users
+            << " users flagged, " << this->split_users << " of them moved to another id of their range ("
+            << this->duplicate_ids << " with no free id left)" << endl;
+    }
+};
+
+/**
+ * Users by id, with the ones whose id is ambiguous (see parse_id) kept apart
+ * An ambiguous id may stand for several users, and for none of the users with an exact id in its range,
+ * so ambiguous users are told apart by their username and only ever found by rows with the same ambiguous id
+ */
+class user_index {
+  public:
+    /** Users of an ambiguous id, one per username in the order they first appear */
+    class ambiguous_group {
+      public:
+        /** Amount of ids the ambiguous one stands for */
+        uint64 range = 1;
+        /** The users */
+        vector<User *> users;
+    };
+
+    /** Users with an exact id, by id */
+    user_map exact;
+    /** Users with an ambiguous id, by the id its digits give */
+    unordered_map<uint64, ambiguous_group> ambiguous;
+
+    /**
+     * Slot of the user a row with `id`, `range` and `username` stands for, null if there's none yet
+     * An exact id is the user whatever its username, an ambiguous one is the user with the same username
+     * The slot has to be filled right away, a new ambiguous user gets an empty slot at the end of its group
+     */
+    User *&find(uint64 id, uint64 range, const char *username) {
+        if (range == 1)
+            return this->exact[id];
+
+        ambiguous_group &group = this->ambiguous[id];
+        group.range            = max(group.range, range);
+
+        for (User *&user : group.users)
+            if (user->has_username(username))
+                return user;
+
+        group.users.push_back(nullptr);
+        return group.users.back();
+    }
+};
+
+/** Least amount of bytes each thread of read_csv gets, fewer don't pay for starting a thread */
+const uint64 CSV_MIN_CHUNK_SIZE = 1 << 18;
+
+/** Users read from a chunk of the file */
+class user_batch {
+  public:
+    /** User of the chunk with the id and range of its first row (see parse_id) */
+    class entry {
+      public:
+        User *user;
+        uint64 id;
+        uint64 range;
+    };
+
+    /** Users of the chunk */
+    user_index users;
+    /** Same users in the order their first row appears in the chunk */
+    vector<entry> order;
+    /** What was read from the chunk */
+    csv_stats stats;
+};
+
+/**
+ * Parse every row in [begin, end) into `batch`, `begin` has to be the start of a row
+ * Rows of a user that already is in the batch update its stats and add their university
+ * Numbers are parsed straight from the mapped bytes, rows with a field that isn't one are skipped
+ */
+void parse_rows(const char *begin, const char *end, user_batch &batch) {
+    csv_tokenizer rows(begin, end);
+    string_view fields[7];
+
+    // Null terminated copies of the fields, longer than User's strings so it's User that cuts them like before
+    char university[64], username[64];
+
+    batch.stats.bytes = end - begin;
+
+    while (const uint32 found = rows.next_row(fields, 7)) {
+        batch.stats.rows++;
+
         // Parse each value when adequate
-        const uint64 id        = stold(fields[1]);
-        const uint32 tweets    = stoul(fields[3]);
-        const uint32 friends   = stoul(fields[4]);
-        const uint32 followers = stoul(fields[5]);
+        uint64 id, range;
+        uint32 tweets, friends, followers;
+
+        // Malformed row
+        if (found != 7 || !parse_id(fields[1], id, range) || !parse_uint(fields[3], tweets)
+            || !parse_uint(fields[4], friends) || !parse_uint(fields[5], followers)) {
+            batch.stats.malformed_rows++;
+            continue;
+        }
 
-        User *existent = users[id];
+        if (range > 1)
+            batch.stats.ambiguous_rows++;
+
+        User *&existent = batch.users.find(id, range, terminated(fields[2], username));
         if (existent != nullptr) {
             // Update stats and add university if one already exists
             existent->update_stats(tweets, friends, followers);
-            existent->add_university(fields[0].c_str());
+            existent->add_university(terminated(fields[0], university));
             continue;
         }
 
         // Create and insert
-        User *user = new User(id, fields[2].c_str(), tweets, friends, followers, string_to_time(fields[6]));
-        user->add_university(fields[0].c_str());
+        User *user = new User(id, username, tweets, friends, followers, string_to_time(fields[6]));
+        user->ambiguous_id = range > 1;
+        user->add_university(terminated(fields[0], university));
+
+        existent = user;
+        batch.order.push_back({user, id, range});
+    }
+}
+
+/**
+ * Fold the users of a later chunk into `users`, with the same result as if its rows had been parsed right after
+ * the ones already there: the later chunk's stats win and its universities are added after the known ones
+ * New users are inserted in the order they first appear, like a single pass over the file would
+ */
+void merge_batch(user_index &users, user_batch &batch, csv_stats &stats) {
+    stats += batch.stats;
+
+    for (const user_batch::entry &entry : batch.order) {
+        User *user      = entry.user;
+        User *&existent = users.find(entry.id, entry.range, user->username);
+        if (existent == nullptr) {
+            existent = user;
+
+            stats.users++;
+            stats.ambiguous_users += user->ambiguous_id;
+            continue;
+        }
 
-        users[user->id] = user;
+        existent->merge(*user);
+        delete user;
     }
+}
+
+/**
+ * Give every user with an ambiguous id its final id and list all the users
+ * The users of an ambiguous id take the ids of its range in the order they first appeared, skipping the ones
+ * exact users have, which are only known once the whole file is read
+ */
+vector<const User *> collect_users(user_index &users, csv_stats &stats) {
+    // By id, so overlapping ranges are given out the same way every time
+    vector<uint64> ids;
+    ids.reserve(users.ambiguous.size());
+
+    for (const auto &pair : users.ambiguous)
+        ids.push_back(pair.first);
+
+    sort(ids.begin(), ids.end());
+
+    // Users left with a taken id, kept out of the map so they don't replace its user
+    vector<const User *> duplicates;
+
+    for (uint64 id : ids) {
+        user_index::ambiguous_group &group = users.ambiguous[id];
+        uint64 offset                      = 0;
+
+        for (User *user : group.users) {
+            while (offset + 1 < group.range && users.exact.count(id + offset) != 0)
+                offset++;
+
+            user->id           = id + offset;
+            stats.split_users += offset != 0;
 
-    csv.close();
+            if (!users.exact.emplace(user->id, user).second) {
+                stats.duplicate_ids++;
+                duplicates.push_back(user);
+            } else if (offset + 1 < group.range) {
+                offset++;
+            }
+        }
+    }
 
     // Hash map -> vector
     vector<const User *> users_vector;
-    for (user_map::iterator::value_type pair : users)
+    users_vector.reserve(users.exact.size() + duplicates.size());
+
+    for (user_map::iterator::value_type pair : users.exact)
         users_vector.push_back(pair.second);
 
+    users_vector.insert(users_vector.end(), duplicates.begin(), duplicates.end());
+    return users_vector;
+}
+
+/**
+ * Read the entire CSV file
+ * The file is memory mapped and its rows are split in place, fields are views of the mapped bytes,
+ * so reading a row allocates nothing
+ * With more than one thread the file is cut into chunks at row boundaries, each parsed on its own thread,
+ * and the chunks are merged in file order, so the result doesn't depend on the amount of threads
+ * Prints what was read, and copies it to `stats` if it isn't null
+ */
+vector<const User *> read_csv(
+    const char *file_name, uint32 threads = thread::hardware_concurrency(), csv_stats *stats = nullptr
+) {
+    cout << "reading .csv" << endl;
+
+    performance timer;
+    timer.start();
+
+    const mapped_file csv(file_name);
+    const char *end = csv.data() + csv.size();
+
+    // remove first line
+    const char *header_end = csv.size() > 0 ? (const char *)memchr(csv.data(), '\n', csv.size()) : nullptr;
+    const char *begin      = header_end != nullptr ? header_end + 1 : end;
+
+    const uint64 size = end - begin;
+    threads           = clamp(size / CSV_MIN_CHUNK_SIZE, (uint64)1, (uint64)max(threads, 1u));
+
+    // Chunk t is [starts[t], starts[t + 1]), each one starts right after the newline that ends the previous one
+    vector<const char *> starts(threads + 1, end);
+    starts[0] = begin;
+
+    for (uint32 t = 1; t < threads; t++) {
+        const char *cut     = max(begin + size * t / threads, starts[t - 1]);
+        const char *newline = cut < end ? (const char *)memchr(cut, '\n', end - cut) : nullptr;
+        starts[t]           = newline != nullptr ? newline + 1 : end;
+    }
+
+    vector<user_batch> batches(threads);
+    parallel_for(threads, [&](uint32 t) { parse_rows(starts[t], starts[t + 1], batches[t]); });
+
+    // Store all users in a hash map for ~O(1) lookup
+    user_index users;
+    csv_stats read;
+    for (user_batch &batch : batches)
+        merge_batch(users, batch, read);
+
+    const vector<const User *> users_vector = collect_users(users, read);
+
+    read.nanoseconds = timer.end();
+    read.info(cout);
+
+    if (stats != nullptr)
+        *stats = read;
+
     return users_vector;
 }
@@ -0,0 +1,354 @@
+#pragma once
+
+#include "map_adt.h"
+#include "memory.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Robin Hood Hashing Hash Map
+ * Linear probing where entries far from their home slot displace entries closer to theirs,
+ * which keeps probe distances even and lets lookups stop as soon as they'd be "richer" than a resident
+ * With `STORE_HASH` every slot keeps the hash of its key, see slot_hash
+ */
+template <typename K, typename V, typename Capacity = prime_capacity, typename Hash = function<int(K)>,
+          typename KeyEqual = equal_to<K>, bool STORE_HASH = false>
+class rh_hash_map : virtual public map_adt<K, V>,
+                    public static_map<rh_hash_map<K, V, Capacity, Hash, KeyEqual, STORE_HASH>, K, V> {
+  private:
+    friend class static_map<rh_hash_map, K, V>;
+
+    /**
+     * key-value pair slot
+     * Stored inline in the table, so probing never leaves its memory
+     */
+    class hash_slot : public slot_hash<STORE_HASH> {
+      public:
+        K key;
+        V value;
+    };
+
+    friend class slot_iterator<rh_hash_map, hash_slot>;
+
+    /** Target load factor */
+    constexpr static const double LOAD_FACTOR_THRESHOLD = 0.9;
+    /** Probe distance at which the table is considered degenerate and gets grown */
+    constexpr static const uint16 MAX_PROBE_DISTANCE = UINT16_MAX;
+
+    /** Policy deciding the size of the table and how hashes are reduced to indexes */
+    Capacity capacity;
+    /** Max size of the table */
+    uint32 max_size;
+    /** Size threshold at which the table should be rehashed */
+    uint32 size_threshold;
+    /** Heap memory held by the map, every table is allocated through it */
+    memory_stats memory;
+    /** Table where all the slots reside */
+    tracked_vector<hash_slot> table;
+    /**
+     * Probe distance of each slot plus one, 0 meaning the slot is empty
+     * Kept apart so probes only touch two bytes per slot
+     */
+    tracked_vector<uint16> distances;
+    /** Current size of the table */
+    uint32 current_size = 0;
+    /** Hash function to calculate the home index of a key */
+    Hash hash_fn;
+    /** Key equality, compared on every probed candidate */
+    KeyEqual key_equal;
+
+    /** Find the index of the slot holding the key, or max_size if there's none */
+    template <typename L> uint32 find(const L &key) {
+        return this->find(key, this->hash_fn(key));
+    }
+
+    /** Find with the already calculated hash of the key */
+    template <typename L> uint32 find(const L &key, uint32 hash) {
+        uint32 index    = this->capacity.index(hash);
+        uint16 distance = 1;
+
+        // A resident closer to its home than we are to ours means the key can't be further ahead
+        while (this->distances[index] >= distance) {
+            if (this->distances[index] == distance && this->table[index].may_match(hash)
+                && this->key_equal(this->table[index].key, key))
+                return index;
+
+            index = this->capacity.wrap(index + 1);
+            distance++;
+        }
+
+        return this->max_size;
+    }
+
+    /** Hash of the key of an occupied slot, read back from the slot when hashes are stored */
+    inline uint32 hash_of(const hash_slot &slot) {
+        if constexpr (STORE_HASH) {
+            return slot.hash;
+        } else {
+            return this->hash_fn(slot.key);
+        }
+    }
+
+    /** Start loading the home slot of a key into cache, returns the hash get_prefetched resolves it with */
+    template <typename L> uint64 prefetch_slots(const L &key) {
+        const uint32 hash  = this->hash_fn(key);
+        const uint32 index = this->capacity.index(hash);
+        prefetch(&this->distances[index]);
+        prefetch(&this->table[index]);
+        return hash;
+    }
+
+    /** Get the value paired with a key whose slots were already prefetched */
+    template <typename L> V get_prefetched(const L &key, uint64 hash) {
+        const uint32 index = this->find(key, hash);
+        return index != this->max_size ? this->table[index].value : nullptr;
+    }
+
+    /**
+     * Insert a key that isn't in the map yet, displacing richer entries along the way
+     * Grows the table if a probe distance doesn't fit in the metadata anymore
+     */
+    void insert_absent(K &&key, V value, uint32 hash) {
+        uint32 index    = this->capacity.index(hash);
+        uint16 distance = 1;
+
+        // Entry being carried forward, a displaced resident takes its place
+        hash_slot entry;
+        entry.key   = move(key);
+        entry.value = value;
+        entry.store_hash(hash);
+
+        while (this->distances[index] != 0) {
+            // Resident is closer to its home -> take its slot and carry it forward
+            if (this->distances[index] < distance) {
+                swap(entry, this->table[index]);
+                swap(distance, this->distances[index]);
+            }
+
+            index = this->capacity.wrap(index + 1);
+            distance++;
+
+            if (distance == MAX_PROBE_DISTANCE) {
+                cout << "[rh] probe distance overflow, rehashing" << endl;
+                this->rehash(this->max_size * 2);
+
+                const uint32 entry_hash = this->hash_of(entry);
+                this->insert_absent(move(entry.key), entry.value, entry_hash);
+                return;
+            }
+        }
+
+        this->table[index]     = move(entry);
+        this->distances[index] = distance;
+        this->current_size++;
+    }
+
+    /** Whether a slot holds a key-value pair */
+    inline bool occupied(uint32 index) const {
+        return this->distances[index] != 0;
+    }
+
+  public:
+    /** Constructor that takes the hash function as a parameter */
+    rh_hash_map(uint32 initial_size, Hash hash_fn = Hash())
+        : max_size(capacity.resize(initial_size)), size_threshold(max_size * LOAD_FACTOR_THRESHOLD),
+          table(max_size, &memory), distances(max_size, 0, &memory), hash_fn(hash_fn) {
+        if (is_empty_fn(this->hash_fn)) {
+            cerr << "hash_fn cannot be null." << endl;
+            exit(1);
+        }
+    }
+
+    /** Deconstructor, slots are owned by the table */
+    ~rh_hash_map() {}
+
+    /** Get the value paired with the key */
+    V get(const K &key) {
+        return this->template get<K>(key);
+    }
+
+    /** Get the value paired with a lookup key, e.g. a string_view for string keys (see is_lookup_key) */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V get(const L &key) {
+        const uint32 index = this->find(key);
+        return index != this->max_size ? this->table[index].value : nullptr;
+    }
+
+    /** Insert a key-value pair */
+    V put(const K &key, V value) {
+        const uint32 hash  = this->hash_fn(key);
+        const uint32 index = this->find(key, hash);
+
+        // Match -> override value
+        if (index != this->max_size) {
+            V previous_value         = this->table[index].value;
+            this->table[index].value = value;
+            return previous_value;
+        }
+
+        if (this->current_size >= this->size_threshold) {
+            cout << "[rh] passed load factor threshold, rehashing" << endl;
+            this->rehash(this->current_size * 2);
+        }
+
+        this->insert_absent(K(key), value, hash);
+        return nullptr;
+    }
+
+    /**
+     * Remove a key-value pair by it's key
+     * Following entries are shifted back one slot until one is already at home or the slot is empty,
+     * so no tombstones are left behind
+     */
+    V remove(const K &key) {
+        return this->template remove<K>(key);
+    }
+
+    /** Remove a key-value pair by a lookup key */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V remove(const L &key) {
+        uint32 index = this->find(key);
+
+        // No match
+        if (index == this->max_size)
+            return nullptr;
+
+        V value = this->table[index].value;
+
+        uint32 next = this->capacity.wrap(index + 1);
+        while (this->distances[next] > 1) {
+            this->table[index]     = move(this->table[next]);
+            this->distances[index] = this->distances[next] - 1;
+            index                  = next;
+            next                   = this->capacity.wrap(next + 1);
+        }
+
+        this->table[index]     = hash_slot();
+        this->distances[index] = 0;
+        this->current_size--;
+
+        return value;
+    }
+
+    /** Get the current size of the map */
+    uint32 size() {
+        return this->current_size;
+    }
+
+    /** Whether the map is empty */
+    bool empty() {
+        return this->current_size == 0;
+    }
+
+    /** Clear the map - resets every slot but keeps the table's capacity */
+    void clear() {
+        for (uint32 i = 0; i < this->max_size; i++) {
+            if (this->distances[i] == 0)
+                continue;
+
+            this->table[i]     = hash_slot();
+            this->distances[i] = 0;
+        }
+
+        this->current_size = 0;
+    }
+
+    /**
+     * Rehash table for new target size
+     * The size is rounded up by the capacity policy (next prime or power of two)
+     * Very costly operation, can be avoided by choosing an appropriate initial size
+     * Keys aren't hashed again when hashes are stored
+     */
+    void rehash(uint32 size) {
+        // Move, don't copy
+        tracked_vector<hash_slot> slots  = move(this->table);
+        tracked_vector<uint16> distances = move(this->distances);
+
+        // Calculate new size and apply
+        const uint32 new_size = this->capacity.resize(size);
+        this->table           = tracked_vector<hash_slot>(new_size, &this->memory);
+        this->distances       = tracked_vector<uint16>(new_size, 0, &this->memory);
+        this->current_size    = 0;
+        this->max_size        = new_size;
+        this->size_threshold  = new_size * LOAD_FACTOR_THRESHOLD;
+
+        // Reinsert slots, keys are already known to be unique
+        for (uint32 i = 0; i < slots.size(); i++) {
+            if (distances[i] != 0) {
+                const uint32 hash = this->hash_of(slots[i]);
+                this->insert_absent(move(slots[i].key), slots[i].value, hash);
+            }
+        }
+    }
+
+    /** Read-only forward iterator over the stored pairs, invalidated by any put, remove or rehash */
+    typedef slot_iterator<rh_hash_map, hash_slot> iterator;
+
+    /** Iterator to the first stored pair, pairs are visited in table order */
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, this->max_size);
+    }
+
+    /**
+     * Vector with all the stored keys
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<K> keys() {
+        vector<K> result;
+        result.reserve(this->current_size);
+
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.key);
+
+        return result;
+    }
+
+    /**
+     * Vector with all the stored values
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<V> values() {
+        vector<V> result;
+        result.reserve(this->current_size);
+
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.value);
+
+        return result;
+    }
+
+    /** Heap memory held by the map */
+    const memory_stats &heap_usage() const {
+        return this->memory;
+    }
+
+    /** Print information about the hash map */
+    void info(stringstream &out) {
+        uint32 max_distance = 0;
+        for (const uint16 distance : this->distances)
+            max_distance = max(max_distance, (uint32)distance);
+
+        out << "[rh] map info:\n"
+            << "max size: " << this->max_size << " (" << Capacity::name << ")\n"
+            << "max probe distance: " << (max_distance > 0 ? max_distance - 1 : 0) << "\n"
+            << "size: " << this->current_size << "\n"
+            << "load factor: " << (double)this->current_size / this->max_size << "\n"
+            << "stored hashes: " << (STORE_HASH ? "yes" : "no") << "\n";
+
+        this->memory.info(out, sizeof(*this), this->current_size * (sizeof(K) + sizeof(V)), this->key_heap_usage());
+        out << endl;
+    }
+};
@@ -1,9 +1,13 @@
 #pragma once
 
 #include "map_adt.h"
+#include "memory.h"
+#include "node_pool.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <functional>
+#include <initializer_list>
 #include <iostream>
 #include <sstream>
 #include <type_traits>
@@ -13,53 +17,181 @@ using namespace std;
 
 /**
  * Separate Chaining Hash Map
+ * `Allocator` decides where nodes come from, heap_allocator or pool_allocator (see node_pool.h)
+ * Can grow incrementally, keeping the old table alive and moving a few of its buckets on every put/remove
  */
-template <typename K, typename V> class sc_hash_map : virtual public map_adt<K, V> {
+template <typename K, typename V, typename Capacity = prime_capacity, typename Hash = function<int(K)>,
+          typename KeyEqual = equal_to<K>, template <typename> class Allocator = heap_allocator>
+class sc_hash_map : virtual public map_adt<K, V>,
+                    public static_map<sc_hash_map<K, V, Capacity, Hash, KeyEqual, Allocator>, K, V> {
   private:
+    friend class static_map<sc_hash_map, K, V>;
+
     /**
      * key-value pair node
      * Includes a pointer to the next node to act as a linked list
+     * Keeps the hash of its key so rehashing doesn't need to compute it again,
+     * and so probes can skip nodes of other keys without comparing them
      */
     class hash_node {
       public:
         K key;
         V value;
+        uint32 hash;
         hash_node *next;
 
-        hash_node(K key, V value) : key(key), value(value) {
+        hash_node(const K &key, V value, uint32 hash) : key(key), value(value), hash(hash) {
             this->next = nullptr;
         }
     };
 
     /** Target load factor */
     constexpr static const double LOAD_FACTOR_THRESHOLD = 1.0;
+    /** Buckets of the old table moved into the current one on every put/remove during an incremental resize */
+    constexpr static const uint32 MIGRATION_STEP = 8;
 
+    /** Policy deciding the size of the table and how hashes are reduced to indexes */
+    Capacity capacity;
     /** Max size of the table */
     uint32 max_size;
     /** Size threshold at which the table should be rehashed */
     uint32 size_threshold;
+    /** Heap memory held by the map, tables and nodes are allocated through it */
+    memory_stats memory;
     /** Table where all the nodes reside */
-    vector<hash_node *> table;
+    tracked_vector<hash_node *> table;
     /** Current size of the table */
     uint32 current_size = 0;
     /** Hash function to calculate the initial index to insert the value at */
-    function<int(K)> hash_fn;
+    Hash hash_fn;
+    /** Key equality, only compared on nodes whose stored hash matches */
+    KeyEqual key_equal;
+    /** Where nodes are allocated from and given back to */
+    Allocator<hash_node> allocator;
+    /** Amount of put and remove calls, to report allocations per op */
+    uint64 operations = 0;
+    /** Whether the table grows a few buckets at a time instead of all at once */
+    bool incremental;
+    /** Table being migrated into `table` during an incremental resize, empty otherwise */
+    tracked_vector<hash_node *> old_table;
+    /** Capacity policy the old table was indexed with */
+    Capacity old_capacity;
+    /** Next bucket of the old table to migrate */
+    uint32 migration_index = 0;
+
+    /** Frees the memory of a linked list from the root node to the tail */
+    void destroy_list(hash_node *node) {
+        while (node != nullptr) {
+            hash_node *next = node->next;
+            this->allocator.destroy(node);
+            node = next;
+        }
+    }
+
+    /** Relink every node of a list at the head of its bucket in the current table */
+    void relink(hash_node *node) {
+        while (node != nullptr) {
+            hash_node *next    = node->next;
+            const uint32 index = this->capacity.index(node->hash);
+
+            node->next         = this->table[index];
+            this->table[index] = node;
+            node               = next;
+        }
+    }
 
-    /** Recursively frees the memory of a linked list from the tail node to the root */
-    static void destroy_list(hash_node *node) {
-        if (node->next == nullptr)
+    /** Start an incremental resize, the current table becomes the old one */
+    void start_migration(uint32 size) {
+        this->finish_migration();
+
+        this->old_table       = move(this->table);
+        this->old_capacity    = this->capacity;
+        this->migration_index = 0;
+
+        const uint32 new_size = this->capacity.resize(size);
+        this->table           = tracked_vector<hash_node *>(new_size, nullptr, &this->memory);
+        this->max_size        = new_size;
+        this->size_threshold  = new_size * LOAD_FACTOR_THRESHOLD;
+    }
+
+    /**
+     * Move the old bucket of `hash` and the next MIGRATION_STEP buckets into the current table
+     * Afterwards the key can only be in the current table, the resize is done once every bucket was moved
+     */
+    void migrate(uint32 hash) {
+        if (this->old_table.empty())
             return;
 
-        destroy_list(node->next);
-        delete node->next;
+        const uint32 index = this->old_capacity.index(hash);
+        this->relink(this->old_table[index]);
+        this->old_table[index] = nullptr;
+
+        const uint32 end = min(this->migration_index + MIGRATION_STEP, (uint32)this->old_table.size());
+        for (; this->migration_index < end; this->migration_index++) {
+            this->relink(this->old_table[this->migration_index]);
+            this->old_table[this->migration_index] = nullptr;
+        }
+
+        if (this->migration_index == this->old_table.size())
+            this->old_table = tracked_vector<hash_node *>(&this->memory);
+    }
+
+    /** Move every remaining bucket of the old table at once */
+    void finish_migration() {
+        for (hash_node *node : this->old_table)
+            this->relink(node);
+
+        this->old_table = tracked_vector<hash_node *>(&this->memory);
+    }
+
+    /**
+     * Start loading the first node of a key's bucket into cache, returns the hash get_prefetched resolves it with
+     * Reading the bucket is a plain load, but the loads of a batch don't depend on each other so they overlap
+     */
+    template <typename L> uint64 prefetch_slots(const L &key) {
+        const uint32 hash = this->hash_fn(key);
+        hash_node *node   = this->table[this->capacity.index(hash)];
+
+        if (node != nullptr)
+            prefetch(node);
+
+        return hash;
+    }
+
+    /**
+     * Get the value paired with a key, `hash` has to be the hash of the key
+     * Taken as the uint32 nodes store, so a negative int hash compares equal to the stored one
+     */
+    template <typename L> V get_prefetched(const L &key, uint32 hash) {
+        hash_node *node = this->table[this->capacity.index(hash)];
+
+        // Stop once we run through the entire table or find a match
+        while (node != nullptr && (node->hash != hash || !this->key_equal(node->key, key))) {
+            node = node->next;
+        }
+
+        // Bucket might not have been migrated yet, lookups don't move anything
+        if (node == nullptr && !this->old_table.empty()) {
+            node = this->old_table[this->old_capacity.index(hash)];
+
+            while (node != nullptr && (node->hash != hash || !this->key_equal(node->key, key))) {
+                node = node->next;
+            }
+        }
+
+        return node != nullptr ? node->value : nullptr;
     }
 
   public:
-    /** Constructor that takes the hash function as a parameter */
-    sc_hash_map(uint32 initial_size, function<int(K)> hash_fn)
-        : max_size(initial_size), size_threshold(initial_size * LOAD_FACTOR_THRESHOLD), table(initial_size, nullptr),
-          hash_fn(hash_fn) {
-        if (hash_fn == nullptr) {
+    /**
+     * Constructor that takes the hash function as a parameter
+     * `incremental` spreads resizes over the following operations instead of pausing on a full rehash
+     */
+    sc_hash_map(uint32 initial_size, Hash hash_fn = Hash(), bool incremental = false)
+        : max_size(capacity.resize(initial_size)), size_threshold(max_size * LOAD_FACTOR_THRESHOLD),
+          table(max_size, nullptr, &memory), hash_fn(hash_fn), allocator(&memory), incremental(incremental),
+          old_table(&memory) {
+        if (is_empty_fn(this->hash_fn)) {
             cerr << "hash_fn cannot be null." << endl;
             exit(1);
         }
@@ -71,41 +203,47 @@ template <typename K, typename V> class sc_hash_map : virtual public map_adt<K,
     }
 
     /** Get the value paired with the key */
-    V get(K key) {
-        const int index = this->hash_fn(key) % this->max_size;
-
-        hash_node *node = this->table[index];
-
-        // Stop once we run through the entire table or find a match
-        while (node != nullptr && node->key != key) {
-            node = node->next;
-        }
+    V get(const K &key) {
+        return this->template get<K>(key);
+    }
 
-        return node != nullptr ? node->value : nullptr;
+    /** Get the value paired with a lookup key, e.g. a string_view for string keys (see is_lookup_key) */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V get(const L &key) {
+        return this->get_prefetched(key, this->hash_fn(key));
     }
 
     /** Insert a key-value pair */
-    V put(K key, V value) {
+    V put(const K &key, V value) {
+        this->operations++;
+
         if (this->current_size >= this->size_threshold) {
-            cout << "[sc] passed load factor threshold, rehashing" << endl;
-            this->rehash(this->current_size * 2);
+            if (this->incremental) {
+                this->start_migration(this->current_size * 2);
+            } else {
+                cout << "[sc] passed load factor threshold, rehashing" << endl;
+                this->rehash(this->current_size * 2);
+            }
         }
 
-        const int index = this->hash_fn(key) % this->max_size;
+        const uint32 hash = this->hash_fn(key);
+        this->migrate(hash);
+
+        const uint32 index = this->capacity.index(hash);
 
         hash_node *destination = this->table[index];
 
         // Create new list if bucket is empty
         if (destination == nullptr) {
             this->current_size++;
-            this->table[index] = new hash_node(key, value);
+            this->table[index] = this->allocator.create(key, value, hash);
             return nullptr;
         }
 
         hash_node *previous_node = nullptr;
 
         // Stop once we get to the end of the list or find a match
-        while (destination != nullptr && destination->key != key) {
+        while (destination != nullptr && (destination->hash != hash || !this->key_equal(destination->key, key))) {
             previous_node = destination;
             destination   = destination->next;
         }
@@ -113,7 +251,7 @@ template <typename K, typename V> class sc_hash_map : virtual public map_adt<K,
         // End of the list
         if (destination == nullptr) {
             this->current_size++;
-            previous_node->next = new hash_node(key, value);
+            previous_node->next = this->allocator.create(key, value, hash);
             return nullptr;
         }
 
@@ -125,14 +263,25 @@ template <typename K, typename V> class sc_hash_map : virtual public map_adt<K,
     }
 
     /** Remove a key-value pair by it's key */
-    V remove(K key) {
-        const int index = this->hash_fn(key) % this->max_size;
+    V remove(const K &key) {
+        return this->template remove<K>(key);
+    }
+
+    /** Remove a key-value pair by a lookup key */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V remove(const L &key) {
+        this->operations++;
+
+        const uint32 hash = this->hash_fn(key);
+        this->migrate(hash);
+
+        const uint32 index = this->capacity.index(hash);
 
         hash_node *node     = this->table[index];
         hash_node *previous = nullptr;
 
         // Stop once we run through the entire list or find a match
-        while (node != nullptr && node->key != key) {
+        while (node != nullptr && (node->hash != hash || !this->key_equal(node->key, key))) {
             previous = node;
             node     = node->next;
         }
@@ -147,11 +296,10 @@ template <typename K, typename V> class sc_hash_map : virtual public map_adt<K,
         if (previous == nullptr) {
             this->table[index] = node->next;
         } else {
-            this->table[index] = previous;
-            previous->next     = node->next;
+            previous->next = node->next;
         }
 
-        delete node;
+        this->allocator.destroy(node);
         this->current_size--;
 
         return value;
@@ -170,46 +318,112 @@ template <typename K, typename V> class sc_hash_map : virtual public map_adt<K,
     /** Clear the map - frees allocated memory */
     void clear() {
         for (uint32 i = 0; i < this->max_size; i++) {
-            hash_node *node = this->table[i];
-            if (node == nullptr)
-                continue;
-
-            destroy_list(node);
+            this->destroy_list(this->table[i]);
             this->table[i] = nullptr;
-            delete node;
         }
 
+        for (hash_node *node : this->old_table)
+            this->destroy_list(node);
+
+        this->old_table    = tracked_vector<hash_node *>(&this->memory);
         this->current_size = 0;
     }
 
     /**
      * Rehash table for new target size
-     * If the size isn't a prime, the next prime is selected
-     * Very costly operation, can be avoided by choosing an appropriate initial size
-     * Can also end up being recursive if there's integer overflow
+     * The size is rounded up by the capacity policy (next prime or power of two)
+     * Existing nodes are relinked into the new buckets using their stored hash,
+     * so the only allocation is the new bucket array
+     * An ongoing incremental resize is finished first
      */
     void rehash(uint32 size) {
-        // Move, don't copy
-        vector<hash_node *> nodes = move(this->table);
+        this->finish_migration();
 
-        for (uint32 i = 0; i < this->max_size; i++) {
-            this->table[i] = nullptr;
-        }
+        // Move, don't copy
+        tracked_vector<hash_node *> buckets = move(this->table);
 
         // Calculate new size and apply
-        const uint32 new_size = find_next_prime(size);
-        this->table.resize(new_size);
-        this->current_size   = 0;
-        this->max_size       = new_size;
-        this->size_threshold = new_size * LOAD_FACTOR_THRESHOLD;
-
-        // Reinsert nodes
-        for (hash_node *node : nodes) {
-            while (node != nullptr) {
-                this->put(node->key, node->value);
-                node = node->next;
+        const uint32 new_size = this->capacity.resize(size);
+        this->table           = tracked_vector<hash_node *>(new_size, nullptr, &this->memory);
+        this->max_size        = new_size;
+        this->size_threshold  = new_size * LOAD_FACTOR_THRESHOLD;
+
+        // Relink nodes at the head of their new bucket
+        for (hash_node *node : buckets)
+            this->relink(node);
+    }
+
+    /**
+     * Read-only forward iterator over the stored pairs, the current table first and the old one after it
+     * Invalidated by any put, remove or rehash
+     */
+    class iterator {
+      private:
+        const sc_hash_map *map;
+        /** Next bucket to look at, past the end of the current table it indexes the old table */
+        uint32 bucket;
+        const hash_node *node = nullptr;
+
+        /** Move forward until a non-empty bucket or the end of both tables */
+        inline void find_node() {
+            const uint32 size  = this->map->table.size();
+            const uint32 total = size + this->map->old_table.size();
+
+            while (this->node == nullptr && this->bucket < total) {
+                this->node = this->bucket < size ? this->map->table[this->bucket]
+                                                 : this->map->old_table[this->bucket - size];
+                this->bucket++;
             }
         }
+
+      public:
+        typedef forward_iterator_tag iterator_category;
+        typedef hash_node value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const hash_node *pointer;
+        typedef const hash_node &reference;
+
+        iterator(const sc_hash_map *map, uint32 bucket) : map(map), bucket(bucket) {
+            this->find_node();
+        }
+
+        inline reference operator*() const {
+            return *this->node;
+        }
+
+        inline pointer operator->() const {
+            return this->node;
+        }
+
+        inline iterator &operator++() {
+            this->node = this->node->next;
+            this->find_node();
+            return *this;
+        }
+
+        inline iterator operator++(int) {
+            iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        /** Every end iterator has no node, so they compare equal wherever they stopped */
+        inline bool operator==(const iterator &other) const {
+            return this->node == other.node;
+        }
+
+        inline bool operator!=(const iterator &other) const {
+            return this->node != other.node;
+        }
+    };
+
+    /** Iterator to the first stored pair, pairs are visited in bucket order */
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, this->table.size() + this->old_table.size());
     }
 
     /**
@@ -218,13 +432,10 @@ template <typename K, typename V> class sc_hash_map : virtual public map_adt<K,
      */
     vector<K> keys() {
         vector<K> result;
+        result.reserve(this->current_size);
 
-        for (hash_node *node : this->table) {
-            while (node != nullptr) {
-                result.push_back(node->key);
-                node = node->next;
-            }
-        }
+        for (const hash_node &node : *this)
+            result.push_back(node.key);
 
         return result;
     }
@@ -235,17 +446,19 @@ template <typename K, typename V> class sc_hash_map : virtual public map_adt<K,
      */
     vector<V> values() {
         vector<V> result;
+        result.reserve(this->current_size);
 
-        for (hash_node *node : this->table) {
-            while (node != nullptr) {
-                result.push_back(node->value);
-                node = node->next;
-            }
-        }
+        for (const hash_node &node : *this)
+            result.push_back(node.value);
 
         return result;
     }
 
+    /** Heap memory held by the map */
+    const memory_stats &heap_usage() const {
+        return this->memory;
+    }
+
     /** Print information about the hash map */
     void info(stringstream &out) {
         int max_depth = 0, filled = 0;
@@ -263,15 +476,16 @@ template <typename K, typename V> class sc_hash_map : virtual public map_adt<K,
         }
 
         out << "[sc] map info:\n"
-            << "max size: " << this->max_size << "\n"
+            << "max size: " << this->max_size << " (" << Capacity::name << ")\n"
             << "max depth: " << max_depth << " in same bucket" << "\n"
             << "size: " << this->current_size << "\n"
             << "load factor: " << (double)this->current_size / this->max_size << "\n"
-            << "size in memory: "
-            << sizeof(*this)
-                   + this->current_size
-                         * (sizeof(hash_node *) + sizeof(hash_node) + (is_pointer<V>::value ? sizeof(*(V){nullptr}) : 0))
-            << " B\n"
-            << endl;
+            << "node allocator: " << Allocator<hash_node>::name << "\n"
+            << "resize: " << (this->incremental ? "incremental" : "stop-the-world") << "\n"
+            << "heap allocations: " << this->allocator.heap_allocations() << " ("
+            << (double)this->allocator.heap_allocations() / max(this->operations, (uint64)1) << " per op)\n";
+
+        this->memory.info(out, sizeof(*this), this->current_size * (sizeof(K) + sizeof(V)), this->key_heap_usage());
+        out << endl;
     }
 };
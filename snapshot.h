@@ -0,0 +1,242 @@
+#pragma once
+
+#include "hash.h"
+#include "mapped_file.h"
+#include "performance.h"
+#include "read_csv.h"
+#include "user.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+// -- Binary snapshot of the users -- //
+// Layout: a 64-byte snapshot_header, then one record per user
+// A record is a User exactly as it sits in memory, strings included (User keeps them in fixed-size arrays), so the
+// records of a mapped snapshot are used in place, without parsing or allocating them
+
+static_assert(is_trivially_copyable<User>::value, "User records are copied as raw bytes");
+static_assert(is_standard_layout<User>::value, "User records are read in place from the file");
+
+/** First bytes of every snapshot */
+constexpr const char SNAPSHOT_MAGIC[8] = {'H', 'W', '2', 'U', 'S', 'E', 'R', 'S'};
+/** Version of the layout, bumped whenever User or the header change */
+constexpr const uint32 SNAPSHOT_VERSION = 1;
+/** Written as is, reads differently on a machine with another byte order */
+constexpr const uint32 SNAPSHOT_BYTE_ORDER = 0x01020304;
+/** Bytes hashed at a time by snapshot_checksum, wy_hash takes 32-bit lengths */
+constexpr const uint64 SNAPSHOT_CHECKSUM_BLOCK = 1 << 20;
+
+/** Header of a snapshot, describes the layout the records were written with */
+class snapshot_header {
+  public:
+    /** SNAPSHOT_MAGIC */
+    char magic[8];
+    /** SNAPSHOT_VERSION */
+    uint32 version;
+    /** SNAPSHOT_BYTE_ORDER */
+    uint32 byte_order;
+    /** sizeof(User) */
+    uint32 record_size;
+    /** alignof(User) */
+    uint32 record_align;
+    /** Amount of records */
+    uint64 user_count;
+    /** snapshot_checksum of the records */
+    uint64 checksum;
+    /** Zeros, pads the header so the records are aligned */
+    uint8 reserved[24];
+};
+
+static_assert(sizeof(snapshot_header) == 64, "snapshot_header is 64 bytes");
+static_assert(sizeof(snapshot_header) % alignof(User) == 0, "records right after the header are aligned");
+
+/** Checksum of the records of a snapshot, the wy_hash of every block chained together */
+inline uint64 snapshot_checksum(const char *bytes, uint64 size) {
+    uint64 checksum = HASH_DEFAULT_SEED ^ size;
+
+    for (uint64 offset = 0; offset < size; offset += SNAPSHOT_CHECKSUM_BLOCK) {
+        const uint64 length = min(size - offset, SNAPSHOT_CHECKSUM_BLOCK);
+        checksum = wy_mum(checksum ^ WY_SECRET_0, wy_hash(string_view(bytes + offset, length)) ^ WY_SECRET_1);
+    }
+
+    return checksum;
+}
+
+/**
+ * Record of a user, with every byte defined: padding and the unused parts of the strings are zeros,
+ * so the same users always give the same file
+ */
+inline void pack_record(const User &user, User &record) {
+    memset((void *)&record, 0, sizeof(User));
+
+    record.id           = user.id;
+    record.tweets       = user.tweets;
+    record.friends      = user.friends;
+    record.followers    = user.followers;
+    record.ambiguous_id = user.ambiguous_id;
+    record.created_at   = user.created_at;
+    memcpy(record.username, user.username, sizeof(user.username));
+
+    for (size_t i = 0; i < size(user.universities) && user.universities[i][0] != 0; i++)
+        memcpy(record.universities[i], user.universities[i], sizeof(user.universities[i]));
+}
+
+/**
+ * Write a snapshot of `users`, in their order
+ * Written to a temporary file that replaces `file_name` once complete, a failed write never leaves half a snapshot
+ */
+void write_snapshot(const char *file_name, const vector<const User *> &users) {
+    vector<User> records(users.size(), User(0, "", 0, 0, 0, 0));
+    for (size_t i = 0; i < users.size(); i++)
+        pack_record(*users[i], records[i]);
+
+    const char *record_bytes = (const char *)records.data();
+    const uint64 record_size = records.size() * sizeof(User);
+
+    snapshot_header header;
+    memset((void *)&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version      = SNAPSHOT_VERSION;
+    header.byte_order   = SNAPSHOT_BYTE_ORDER;
+    header.record_size  = sizeof(User);
+    header.record_align = alignof(User);
+    header.user_count   = users.size();
+    header.checksum     = snapshot_checksum(record_bytes, record_size);
+
+    const string temporary = string(file_name) + ".tmp";
+    FILE *file             = fopen(temporary.c_str(), "wb");
+
+    const bool written = file != nullptr && fwrite(&header, sizeof(header), 1, file) == 1
+                      && fwrite(record_bytes, 1, record_size, file) == record_size;
+
+    if (file == nullptr || fclose(file) != 0 || !written) {
+        cerr << "could not write " << temporary << "." << endl;
+        exit(1);
+    }
+
+    filesystem::rename(temporary, file_name);
+}
+
+/**
+ * Users of a memory mapped snapshot
+ * Loading only maps the file and checks its header, the users are the records of the mapping, so it takes the same
+ * time whatever the amount of users. Checking the records against the checksum reads them all, so it's left to verify
+ * The users live as long as the snapshot does
+ */
+class user_snapshot {
+  private:
+    /** The snapshot file */
+    const mapped_file file;
+    /** First record, right after the header */
+    const User *records = nullptr;
+    /** Amount of records */
+    uint64 count = 0;
+    /** Checksum of the records written in the header */
+    uint64 checksum = 0;
+
+    /** Exit because the file isn't a snapshot this build can read */
+    [[noreturn]] static void reject(const char *file_name, const char *reason) {
+        cerr << file_name << " is not a usable snapshot: " << reason << "." << endl;
+        exit(1);
+    }
+
+  public:
+    /** Constructor, maps `file_name` and exits if it isn't a snapshot of the current User layout */
+    user_snapshot(const char *file_name) : file(file_name) {
+        if (this->file.size() < sizeof(snapshot_header))
+            reject(file_name, "too small for a header");
+
+        const snapshot_header *header = (const snapshot_header *)this->file.data();
+
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+            reject(file_name, "wrong magic");
+        if (header->version != SNAPSHOT_VERSION)
+            reject(file_name, "written by another version");
+        if (header->byte_order != SNAPSHOT_BYTE_ORDER)
+            reject(file_name, "written with another byte order");
+        if (header->record_size != sizeof(User) || header->record_align != alignof(User))
+            reject(file_name, "written with another User layout");
+        if (header->user_count != (this->file.size() - sizeof(snapshot_header)) / sizeof(User)
+            || (this->file.size() - sizeof(snapshot_header)) % sizeof(User) != 0)
+            reject(file_name, "size doesn't match the amount of users");
+
+        this->records  = (const User *)(this->file.data() + sizeof(snapshot_header));
+        this->count    = header->user_count;
+        this->checksum = header->checksum;
+    }
+
+    user_snapshot(const user_snapshot &) = delete;
+
+    /** Amount of users */
+    uint64 size() const {
+        return this->count;
+    }
+
+    /** User at `index` */
+    const User &operator[](uint64 index) const {
+        return this->records[index];
+    }
+
+    /** Every user, in the order they were written, read in place from the mapping */
+    user_list users() const {
+        return user_list(this->records, this->count);
+    }
+
+    /** Whether the records match the header's checksum, reads every one of them */
+    bool verify() const {
+        return snapshot_checksum((const char *)this->records, this->count * sizeof(User)) == this->checksum;
+    }
+};
+
+/**
+ * Load the users from the snapshot of a CSV file, built from the CSV first if there's none or the CSV is newer
+ * Building reads the CSV once, every later load only maps the snapshot
+ * With `verify` the records are checked against their checksum, exits if they don't match
+ */
+unique_ptr<user_snapshot> load_snapshot(
+    const char *csv_file_name, const char *snapshot_file_name, bool verify = false
+) {
+    if (!filesystem::exists(snapshot_file_name)
+        || filesystem::last_write_time(csv_file_name) > filesystem::last_write_time(snapshot_file_name)) {
+        const vector<const User *> users = read_csv(csv_file_name);
+
+        cout << "[snapshot] writing " << snapshot_file_name << endl;
+        write_snapshot(snapshot_file_name, users);
+
+        for (const User *user : users)
+            delete user;
+    }
+
+    performance timer;
+    timer.start();
+
+    unique_ptr<user_snapshot> snapshot = make_unique<user_snapshot>(snapshot_file_name);
+
+    cout << "[snapshot] loaded " << snapshot->size() << " users from " << snapshot_file_name << " in "
+         << timer.end<performance::microseconds>() << " μs" << endl;
+
+    if (verify) {
+        timer.start();
+
+        if (!snapshot->verify()) {
+            cerr << snapshot_file_name << " is not a usable snapshot: checksum mismatch." << endl;
+            exit(1);
+        }
+
+        cout << "[snapshot] checksum verified in " << timer.end<performance::microseconds>() << " μs" << endl;
+    }
+
+    return snapshot;
+}
@@ -0,0 +1,387 @@
+#pragma once
+
+#include "map_adt.h"
+#include "memory.h"
+
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SW_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+/**
+ * Swiss Table Hash Map
+ * Slots are grouped 16 at a time, each with a 1-byte control tag holding 7 bits of the hash,
+ * so a single SSE2 compare finds every candidate slot of a group before any key is compared
+ */
+template <typename K, typename V, typename Hash = function<int(K)>, typename KeyEqual = equal_to<K>>
+class sw_hash_map : virtual public map_adt<K, V>, public static_map<sw_hash_map<K, V, Hash, KeyEqual>, K, V> {
+  private:
+    friend class static_map<sw_hash_map, K, V>;
+
+    /**
+     * key-value pair slot
+     * Stored inline in the table, so probing never leaves its memory
+     */
+    class hash_slot {
+      public:
+        K key;
+        V value;
+    };
+
+    friend class slot_iterator<sw_hash_map, hash_slot>;
+
+    /** Control byte of a slot that was never used */
+    constexpr static const uint8 EMPTY = 0x80;
+    /** Control byte of a slot whose entry was removed (tombstone) */
+    constexpr static const uint8 DELETED = 0xFE;
+    /** Amount of slots per group, one SSE2 register of control bytes */
+    constexpr static const uint32 GROUP_SIZE = 16;
+    /** Target load factor, tombstones included */
+    constexpr static const double LOAD_FACTOR_THRESHOLD = 0.875;
+
+    /** Max size of the table, always a multiple of GROUP_SIZE */
+    uint32 max_size;
+    /** Amount of groups minus one, used as a mask since it's always a power of two */
+    uint32 group_mask;
+    /** Size threshold at which the table should be rehashed */
+    uint32 size_threshold;
+    /** Heap memory held by the map, every table is allocated through it */
+    memory_stats memory;
+    /** Table where all the slots reside */
+    tracked_vector<hash_slot> table;
+    /** Control byte of each slot, EMPTY, DELETED or the 7-bit tag of the stored key */
+    tracked_vector<uint8> controls;
+    /** Current size of the table */
+    uint32 current_size = 0;
+    /** Amount of DELETED control bytes */
+    uint32 tombstones = 0;
+    /** Hash function to calculate the group and tag of a key */
+    Hash hash_fn;
+    /** Key equality, compared on every probed candidate */
+    KeyEqual key_equal;
+
+    /** Index of the lowest set bit */
+    static inline uint32 count_trailing_zeros(uint32 mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    /** Bitmask of the slots in a group whose control byte is equal to `control` */
+    static inline uint32 match(const uint8 *group, uint8 control) {
+#ifdef SW_USE_SSE2
+        const __m128i controls = _mm_loadu_si128((const __m128i *)group);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(controls, _mm_set1_epi8((char)control)));
+#else
+        uint32 mask = 0;
+        for (uint32 i = 0; i < GROUP_SIZE; i++)
+            mask |= (uint32)(group[i] == control) << i;
+        return mask;
+#endif
+    }
+
+    /** Bitmask of the slots in a group that are EMPTY or DELETED, both have the high bit set */
+    static inline uint32 match_free(const uint8 *group) {
+#ifdef SW_USE_SSE2
+        return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+        uint32 mask = 0;
+        for (uint32 i = 0; i < GROUP_SIZE; i++)
+            mask |= (uint32)(group[i] >> 7) << i;
+        return mask;
+#endif
+    }
+
+    /**
+     * Spread the hash over 64 bits, the user provided hash can be weak (e.g. small modulo)
+     * The high 7 bits become the tag, the upper half selects the group
+     */
+    static inline uint64 mix(int hash) {
+        return (uint64)(uint32)hash * 0x9E3779B97F4A7C15ull;
+    }
+
+    /** Find the index of the slot holding the key, or max_size if there's none */
+    template <typename L> uint32 find(const L &key) {
+        return this->find(key, mix(this->hash_fn(key)));
+    }
+
+    /** Find with the already mixed hash of the key */
+    template <typename L> uint32 find(const L &key, uint64 hash) {
+        const uint8 tag   = hash >> 57;
+        uint32 group      = (hash >> 32) & this->group_mask;
+
+        // Triangular probing visits every group once when the amount of groups is a power of two
+        for (uint32 step = 1; step <= this->group_mask + 1; step++) {
+            const uint8 *controls = &this->controls[group * GROUP_SIZE];
+
+            for (uint32 mask = match(controls, tag); mask != 0; mask &= mask - 1) {
+                const uint32 index = group * GROUP_SIZE + count_trailing_zeros(mask);
+                if (this->key_equal(this->table[index].key, key))
+                    return index;
+            }
+
+            // An empty slot means the key would've been inserted here
+            if (match(controls, EMPTY) != 0)
+                break;
+
+            group = (group + step) & this->group_mask;
+        }
+
+        return this->max_size;
+    }
+
+    /** Start loading the first group of a key into cache, returns the hash get_prefetched resolves it with */
+    template <typename L> uint64 prefetch_slots(const L &key) {
+        const uint64 hash  = mix(this->hash_fn(key));
+        const uint32 group = (hash >> 32) & this->group_mask;
+        prefetch(&this->controls[group * GROUP_SIZE]);
+        prefetch(&this->table[group * GROUP_SIZE]);
+        return hash;
+    }
+
+    /** Get the value paired with a key whose slots were already prefetched */
+    template <typename L> V get_prefetched(const L &key, uint64 hash) {
+        const uint32 index = this->find(key, hash);
+        return index != this->max_size ? this->table[index].value : nullptr;
+    }
+
+    /** Insert a key that isn't in the map yet into the first free slot of its probe sequence */
+    void insert_absent(K key, V value) {
+        const uint64 hash = mix(this->hash_fn(key));
+        uint32 group      = (hash >> 32) & this->group_mask;
+        uint32 mask       = match_free(&this->controls[group * GROUP_SIZE]);
+
+        for (uint32 step = 1; mask == 0; step++) {
+            group = (group + step) & this->group_mask;
+            mask  = match_free(&this->controls[group * GROUP_SIZE]);
+        }
+
+        const uint32 index = group * GROUP_SIZE + count_trailing_zeros(mask);
+
+        if (this->controls[index] == DELETED)
+            this->tombstones--;
+
+        this->table[index].key   = move(key);
+        this->table[index].value = value;
+        this->controls[index]    = hash >> 57;
+        this->current_size++;
+    }
+
+    /** Set the table to the amount of groups needed to fit `size` slots */
+    void allocate(uint32 size) {
+        uint32 groups = 1;
+        while (groups * GROUP_SIZE < size)
+            groups <<= 1;
+
+        this->max_size       = groups * GROUP_SIZE;
+        this->group_mask     = groups - 1;
+        this->size_threshold = this->max_size * LOAD_FACTOR_THRESHOLD;
+        this->table          = tracked_vector<hash_slot>(this->max_size, &this->memory);
+        this->controls       = tracked_vector<uint8>(this->max_size, EMPTY, &this->memory);
+        this->current_size   = 0;
+        this->tombstones     = 0;
+    }
+
+    /** Whether a slot holds a key-value pair */
+    inline bool occupied(uint32 index) const {
+        return (this->controls[index] & EMPTY) == 0;
+    }
+
+  public:
+    /** Constructor that takes the hash function as a parameter */
+    sw_hash_map(uint32 initial_size, Hash hash_fn = Hash()) : hash_fn(hash_fn) {
+        if (is_empty_fn(this->hash_fn)) {
+            cerr << "hash_fn cannot be null." << endl;
+            exit(1);
+        }
+
+        this->allocate(initial_size);
+    }
+
+    /** Deconstructor, slots are owned by the table */
+    ~sw_hash_map() {}
+
+    /** Get the value paired with the key */
+    V get(const K &key) {
+        return this->template get<K>(key);
+    }
+
+    /** Get the value paired with a lookup key, e.g. a string_view for string keys (see is_lookup_key) */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V get(const L &key) {
+        const uint32 index = this->find(key);
+        return index != this->max_size ? this->table[index].value : nullptr;
+    }
+
+    /** Insert a key-value pair */
+    V put(const K &key, V value) {
+        const uint32 index = this->find(key);
+
+        // Match -> override value
+        if (index != this->max_size) {
+            V previous_value         = this->table[index].value;
+            this->table[index].value = value;
+            return previous_value;
+        }
+
+        if (this->current_size + this->tombstones >= this->size_threshold) {
+            cout << "[sw] passed load factor threshold, rehashing" << endl;
+            // Mostly tombstones -> clean them up in a table of the same size
+            this->rehash(this->current_size >= this->size_threshold / 2 ? this->max_size * 2 : this->max_size);
+        }
+
+        this->insert_absent(key, value);
+        return nullptr;
+    }
+
+    /**
+     * Remove a key-value pair by it's key
+     * The slot goes back to EMPTY if its group still has one, since no probe could've passed through it,
+     * otherwise it's left as a tombstone
+     */
+    V remove(const K &key) {
+        return this->template remove<K>(key);
+    }
+
+    /** Remove a key-value pair by a lookup key */
+    template <typename L, enable_if_t<is_lookup_key<K, L, Hash, KeyEqual>::value, int> = 0>
+    V remove(const L &key) {
+        const uint32 index = this->find(key);
+
+        // No match
+        if (index == this->max_size)
+            return nullptr;
+
+        V value = this->table[index].value;
+
+        const uint8 *group = &this->controls[index - index % GROUP_SIZE];
+        if (match(group, EMPTY) != 0) {
+            this->controls[index] = EMPTY;
+        } else {
+            this->controls[index] = DELETED;
+            this->tombstones++;
+        }
+
+        this->table[index] = hash_slot();
+        this->current_size--;
+
+        return value;
+    }
+
+    /** Get the current size of the map */
+    uint32 size() {
+        return this->current_size;
+    }
+
+    /** Whether the map is empty */
+    bool empty() {
+        return this->current_size == 0;
+    }
+
+    /** Clear the map - resets every slot but keeps the table's capacity */
+    void clear() {
+        for (uint32 i = 0; i < this->max_size; i++) {
+            if (this->controls[i] == EMPTY)
+                continue;
+
+            this->table[i]    = hash_slot();
+            this->controls[i] = EMPTY;
+        }
+
+        this->current_size = 0;
+        this->tombstones   = 0;
+    }
+
+    /**
+     * Rehash table for new target size
+     * The size is rounded up to a power of two amount of groups
+     * Very costly operation, can be avoided by choosing an appropriate initial size
+     */
+    void rehash(uint32 size) {
+        // Move, don't copy
+        tracked_vector<hash_slot> slots = move(this->table);
+        tracked_vector<uint8> controls  = move(this->controls);
+
+        this->allocate(size);
+
+        // Reinsert slots, keys are already known to be unique
+        for (uint32 i = 0; i < slots.size(); i++)
+            if ((controls[i] & EMPTY) == 0)
+                this->insert_absent(move(slots[i].key), slots[i].value);
+    }
+
+    /** Read-only forward iterator over the stored pairs, invalidated by any put, remove or rehash */
+    typedef slot_iterator<sw_hash_map, hash_slot> iterator;
+
+    /** Iterator to the first stored pair, pairs are visited in table order */
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, this->max_size);
+    }
+
+    /**
+     * Vector with all the stored keys
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<K> keys() {
+        vector<K> result;
+        result.reserve(this->current_size);
+
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.key);
+
+        return result;
+    }
+
+    /**
+     * Vector with all the stored values
+     * Does not guarantee the same order as they were inserted
+     */
+    vector<V> values() {
+        vector<V> result;
+        result.reserve(this->current_size);
+
+        for (const hash_slot &slot : *this)
+            result.push_back(slot.value);
+
+        return result;
+    }
+
+    /** Heap memory held by the map */
+    const memory_stats &heap_usage() const {
+        return this->memory;
+    }
+
+    /** Print information about the hash map */
+    void info(stringstream &out) {
+        out << "[sw] map info:\n"
+            << "max size: " << this->max_size << "\n"
+            << "groups: " << this->group_mask + 1 << "\n"
+            << "size: " << this->current_size << "\n"
+            << "tombstones: " << this->tombstones << "\n"
+            << "load factor: " << (double)this->current_size / this->max_size << "\n";
+
+        this->memory.info(out, sizeof(*this), this->current_size * (sizeof(K) + sizeof(V)), this->key_heap_usage());
+        out << endl;
+    }
+};
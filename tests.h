@@ -1,62 +1,115 @@
 #pragma once
 
+#include "cc_hash_map.h"
 #include "dh_hash_map.h"
+#include "frozen_map.h"
+#include "lf_hash_map.h"
 #include "lp_hash_map.h"
 #include "performance.h"
+#include "read_csv.h"
 #include "qp_hash_map.h"
+#include "rh_hash_map.h"
 #include "sc_hash_map.h"
+#include "sw_hash_map.h"
 #include "user.h"
 
+#include <algorithm>
 #include <cmath>
 #include <ctime>
+#include <filesystem>
 #include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <list>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#ifdef _WIN32
+#define timegm _mkgmtime
+#endif
+
 using namespace std;
 
 /** Range by which to take timing measures */
 const int TIMING_MEASURE_RANGE = 100;
+/** Initial size of the maps in the put latency tests, small so they go through every resize */
+const int LATENCY_INITIAL_SIZE = 16;
 
 /** Struct containing measurements for all hash maps */
 typedef struct measurement {
     uint64 sc  = 0;
+    uint64 scp = 0;
     uint64 lp  = 0;
     uint64 qp  = 0;
     uint64 dh  = 0;
+    uint64 rh  = 0;
+    uint64 sw  = 0;
     uint64 stl = 0;
 } measurement;
 
-template <typename K> void stl_map_info(stringstream &out, unordered_map<K, const User *, function<int(K)>> &map) {
+/** unordered_map whose nodes and buckets are recorded in a memory_stats */
+template <typename K, typename Hash>
+using tracked_stl_map
+    = unordered_map<K, const User *, Hash, equal_to<K>, tracking_allocator<pair<const K, const User *>>>;
+
+template <typename K, typename Hash>
+void stl_map_info(stringstream &out, tracked_stl_map<K, Hash> &map, const memory_stats &memory) {
+    uint64 key_bytes = 0;
+    for (const auto &entry : map)
+        key_bytes += key_heap_bytes(entry.first);
+
     out << "[stl] map info:\n"
         << "max size: " << (uint64)map.bucket_count() << "\n"
         << "size: " << (uint64)map.size() << "\n"
-        << "load factor: " << map.load_factor() << "\n"
-        << "size in memory: "
-        << (uint64)(sizeof(map)
-                    + map.size()
-                          * (sizeof(list<pair<const K, const User *>>) + sizeof(pair<const K, const User *>) + sizeof(User)))
-        << " B";
+        << "load factor: " << map.load_factor() << "\n";
+
+    memory.info(out, sizeof(map), map.size() * (sizeof(K) + sizeof(const User *)), key_bytes);
 }
 
+/**
+ * Interface the map operations are measured through
+ * map_adt goes through the vtable, static_map calls straight into the map
+ */
+template <bool DYNAMIC_DISPATCH, typename M, typename K, typename V>
+using map_interface = conditional_t<DYNAMIC_DISPATCH, map_adt<K, V>, static_map<M, K, V>>;
+
 /**
  * Run N amount of tests on all hash maps
  * Measurement results are saved in a file prefixed by `file_name_prefix`
+ * `Capacity` selects how the maps size their tables and reduce hashes to indexes (prime or pow2)
+ * `DYNAMIC_DISPATCH` measures the operations through map_adt instead of static_map
+ * `STORE_HASH` makes lp, qp and rh keep the hash of every key in its slot (sc always does)
+ * The hash types are deduced, pass static_hash functors to let hashing be inlined or std::function to compare
+ * `get_key_fn` may return a lookup key instead of a K (e.g. string_view for string keys),
+ * then get and remove don't construct any K, only put converts it
+ * The batch tests call put_batch/get_batch once per range, always statically dispatched
  */
-template <typename K, int SC_N, int L_N>
+template <
+    typename K,
+    int SC_N,
+    int L_N,
+    typename Capacity     = prime_capacity,
+    bool DYNAMIC_DISPATCH = false,
+    bool STORE_HASH       = false,
+    typename KeyFn,
+    typename ScHash,
+    typename LHash,
+    typename DhHash>
 void run_tests(
     string file_name_prefix,
     const int tests,
-    const vector<const User *> &users,
-    function<K(const User *)> get_key_fn,
-    function<int(const K &)> sc_hash_fn,
-    function<int(const K &)> l_hash_fn,
-    function<int(const K &)> dh_hash_fn
+    const user_list &users,
+    KeyFn get_key_fn,
+    ScHash sc_hash_fn,
+    LHash l_hash_fn,
+    DhHash dh_hash_fn
 ) {
     // Print time at which the test was started
     time_t now = time(nullptr);
@@ -75,33 +128,63 @@ void run_tests(
 
     // Prepare the test
     p.start();
-    sc_hash_map<K, const User *> sc_map(SC_N, sc_hash_fn);
+    sc_hash_map<K, const User *, Capacity, ScHash, equal_to<>> sc_impl(SC_N, sc_hash_fn);
     int t_c = p.end();
     cout << "[sc] creation: " << t_c / 1e3 << " μs\n";
 
     p.start();
-    lp_hash_map<K, const User *> lp_map(L_N, l_hash_fn);
+    sc_hash_map<K, const User *, Capacity, ScHash, equal_to<>, pool_allocator> scp_impl(SC_N, sc_hash_fn);
+    t_c = p.end();
+    cout << "[scp] creation: " << t_c / 1e3 << " μs\n";
+
+    p.start();
+    lp_hash_map<K, const User *, Capacity, LHash, equal_to<>, STORE_HASH> lp_impl(L_N, l_hash_fn);
     t_c = p.end();
     cout << "[lp] creation: " << t_c / 1e3 << " μs\n";
 
     p.start();
-    qp_hash_map<K, const User *> qp_map(L_N, l_hash_fn);
+    qp_hash_map<K, const User *, Capacity, LHash, equal_to<>, STORE_HASH> qp_impl(L_N, l_hash_fn);
     t_c = p.end();
     cout << "[qb] creation: " << t_c / 1e3 << " μs\n";
 
     p.start();
-    dh_hash_map<K, const User *> dh_map(L_N, l_hash_fn, dh_hash_fn);
+    dh_hash_map<K, const User *, Capacity, LHash, DhHash, equal_to<>> dh_impl(L_N, l_hash_fn, dh_hash_fn);
     t_c = p.end();
     cout << "[dh] creation: " << t_c / 1e3 << " μs\n";
 
     p.start();
-    unordered_map<K, const User *, function<int(K)>> stl_map(SC_N, sc_hash_fn);
+    rh_hash_map<K, const User *, Capacity, LHash, equal_to<>, STORE_HASH> rh_impl(L_N, l_hash_fn);
+    t_c = p.end();
+    cout << "[rh] creation: " << t_c / 1e3 << " μs\n";
+
+    p.start();
+    sw_hash_map<K, const User *, LHash, equal_to<>> sw_impl(L_N, l_hash_fn);
+    t_c = p.end();
+    cout << "[sw] creation: " << t_c / 1e3 << " μs\n";
+
+    p.start();
+    memory_stats stl_memory;
+    tracked_stl_map<K, ScHash> stl_map(SC_N, sc_hash_fn, equal_to<K>(), &stl_memory);
     t_c = p.end();
     cout << "[stl] creation: " << t_c / 1e3 << " μs\n\n";
 
+    // Interfaces the operations are measured through
+    map_interface<DYNAMIC_DISPATCH, decltype(sc_impl), K, const User *> &sc_map   = sc_impl;
+    map_interface<DYNAMIC_DISPATCH, decltype(scp_impl), K, const User *> &scp_map = scp_impl;
+    map_interface<DYNAMIC_DISPATCH, decltype(lp_impl), K, const User *> &lp_map   = lp_impl;
+    map_interface<DYNAMIC_DISPATCH, decltype(qp_impl), K, const User *> &qp_map   = qp_impl;
+    map_interface<DYNAMIC_DISPATCH, decltype(dh_impl), K, const User *> &dh_map   = dh_impl;
+    map_interface<DYNAMIC_DISPATCH, decltype(rh_impl), K, const User *> &rh_map   = rh_impl;
+    map_interface<DYNAMIC_DISPATCH, decltype(sw_impl), K, const User *> &sw_map   = sw_impl;
+
     stringstream timings, results;
     timings << "users,op,map,time\n";
 
+    // Keys and values of a range for the batch tests
+    vector<decay_t<invoke_result_t<KeyFn, const User *>>> batch_keys(TIMING_MEASURE_RANGE);
+    vector<K> batch_put_keys(TIMING_MEASURE_RANGE);
+    vector<const User *> batch_values(TIMING_MEASURE_RANGE);
+
     measurement times;
     total.start();
 
@@ -114,46 +197,66 @@ void run_tests(
 
             for (int i = start_range; i < end_range; i++) {
                 const User *user = users[i];
-                const K key      = get_key_fn(user);
+                const auto key   = get_key_fn(user);
+                // Owned copy of the key, made before timing so a string_view key adds no allocation to a put
+                const K owned_key(key);
 
                 p.start();
-                sc_map.put(key, user);
+                do_not_optimize(sc_map.put(owned_key, user));
                 times.sc += p.end();
 
                 p.start();
-                lp_map.put(key, user);
+                do_not_optimize(scp_map.put(owned_key, user));
+                times.scp += p.end();
+
+                p.start();
+                do_not_optimize(lp_map.put(owned_key, user));
                 times.lp += p.end();
 
                 p.start();
-                qp_map.put(key, user);
+                do_not_optimize(qp_map.put(owned_key, user));
                 times.qp += p.end();
 
                 p.start();
-                dh_map.put(key, user);
+                do_not_optimize(dh_map.put(owned_key, user));
                 times.dh += p.end();
 
                 p.start();
-                stl_map[key] = user;
+                do_not_optimize(rh_map.put(owned_key, user));
+                times.rh += p.end();
+
+                p.start();
+                do_not_optimize(sw_map.put(owned_key, user));
+                times.sw += p.end();
+
+                p.start();
+                stl_map[owned_key] = user;
                 times.stl += p.end();
             }
 
             timings << end_range << ",put,sc," << times.sc << "\n"
+                    << end_range << ",put,scp," << times.scp << "\n"
                     << end_range << ",put,lp," << times.lp << "\n"
                     << end_range << ",put,qp," << times.qp << "\n"
                     << end_range << ",put,dh," << times.dh << "\n"
+                    << end_range << ",put,rh," << times.rh << "\n"
+                    << end_range << ",put,sw," << times.sw << "\n"
                     << end_range << ",put,stl," << times.stl << "\n";
 
             start_range = end_range;
-            times       = {0, 0, 0, 0, 0};
+            times       = {0, 0, 0, 0, 0, 0, 0, 0};
         }
 
         if (n_test == 0) {
             // Record maps information to print at the end
-            sc_map.info(results);
-            lp_map.info(results);
-            qp_map.info(results);
-            dh_map.info(results);
-            stl_map_info(results, stl_map);
+            sc_impl.info(results);
+            scp_impl.info(results);
+            lp_impl.info(results);
+            qp_impl.info(results);
+            dh_impl.info(results);
+            rh_impl.info(results);
+            sw_impl.info(results);
+            stl_map_info(results, stl_map, stl_memory);
         }
 
         start_range = 0;
@@ -163,26 +266,40 @@ void run_tests(
 
             for (int i = start_range; i < end_range; i++) {
                 const User *user = users[i];
-                const K key      = get_key_fn(user);
+                const auto key   = get_key_fn(user);
+                const K owned_key(key);
 
                 p.start();
-                sc_map.get(key);
+                do_not_optimize(sc_map.get(key));
                 times.sc += p.end();
 
                 p.start();
-                lp_map.get(key);
+                do_not_optimize(scp_map.get(key));
+                times.scp += p.end();
+
+                p.start();
+                do_not_optimize(lp_map.get(key));
                 times.lp += p.end();
 
                 p.start();
-                qp_map.get(key);
+                do_not_optimize(qp_map.get(key));
                 times.qp += p.end();
 
                 p.start();
-                dh_map.get(key);
+                do_not_optimize(dh_map.get(key));
                 times.dh += p.end();
 
                 p.start();
-                stl_map[key];
+                do_not_optimize(rh_map.get(key));
+                times.rh += p.end();
+
+                p.start();
+                do_not_optimize(sw_map.get(key));
+                times.sw += p.end();
+
+                p.start();
+                // unordered_map only has heterogeneous lookup since C++20
+                do_not_optimize(stl_map[owned_key]);
                 times.stl += p.end();
 
                 /*
@@ -204,13 +321,79 @@ void run_tests(
             }
 
             timings << end_range << ",get_(hit),sc," << times.sc << "\n"
+                    << end_range << ",get_(hit),scp," << times.scp << "\n"
                     << end_range << ",get_(hit),lp," << times.lp << "\n"
                     << end_range << ",get_(hit),qp," << times.qp << "\n"
                     << end_range << ",get_(hit),dh," << times.dh << "\n"
+                    << end_range << ",get_(hit),rh," << times.rh << "\n"
+                    << end_range << ",get_(hit),sw," << times.sw << "\n"
                     << end_range << ",get_(hit),stl," << times.stl << "\n";
 
             start_range = end_range;
-            times       = {0, 0, 0, 0, 0};
+            times       = {0, 0, 0, 0, 0, 0, 0, 0};
+        }
+
+        start_range = 0;
+        // map.get_batch(keys) (hit) tests, one call per range
+        for (int _ = 0; _ < ranges_amount; _++) {
+            const int end_range = min(start_range + TIMING_MEASURE_RANGE, users_size);
+            const int count     = end_range - start_range;
+
+            for (int i = start_range; i < end_range; i++)
+                batch_keys[i - start_range] = get_key_fn(users[i]);
+
+            p.start();
+            sc_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.sc += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            scp_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.scp += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            lp_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.lp += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            qp_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.qp += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            dh_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.dh += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            rh_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.rh += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            sw_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.sw += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            for (int i = 0; i < count; i++)
+                batch_values[i] = stl_map[K(batch_keys[i])];
+            times.stl += p.end();
+            do_not_optimize(batch_values.data());
+
+            timings << end_range << ",get_batch_(hit),sc," << times.sc << "\n"
+                    << end_range << ",get_batch_(hit),scp," << times.scp << "\n"
+                    << end_range << ",get_batch_(hit),lp," << times.lp << "\n"
+                    << end_range << ",get_batch_(hit),qp," << times.qp << "\n"
+                    << end_range << ",get_batch_(hit),dh," << times.dh << "\n"
+                    << end_range << ",get_batch_(hit),rh," << times.rh << "\n"
+                    << end_range << ",get_batch_(hit),sw," << times.sw << "\n"
+                    << end_range << ",get_batch_(hit),stl," << times.stl << "\n";
+
+            start_range = end_range;
+            times       = {0, 0, 0, 0, 0, 0, 0, 0};
         }
 
         start_range = 0;
@@ -220,26 +403,39 @@ void run_tests(
 
             for (int i = start_range; i < end_range; i++) {
                 const User *user = users[i];
-                const K key      = get_key_fn(user);
+                const auto key   = get_key_fn(user);
+                const K owned_key(key);
 
                 p.start();
-                sc_map.remove(key);
+                do_not_optimize(sc_map.remove(key));
                 times.sc += p.end();
 
                 p.start();
-                lp_map.remove(key);
+                do_not_optimize(scp_map.remove(key));
+                times.scp += p.end();
+
+                p.start();
+                do_not_optimize(lp_map.remove(key));
                 times.lp += p.end();
 
                 p.start();
-                qp_map.remove(key);
+                do_not_optimize(qp_map.remove(key));
                 times.qp += p.end();
 
                 p.start();
-                dh_map.remove(key);
+                do_not_optimize(dh_map.remove(key));
                 times.dh += p.end();
 
                 p.start();
-                stl_map.erase(key);
+                do_not_optimize(rh_map.remove(key));
+                times.rh += p.end();
+
+                p.start();
+                do_not_optimize(sw_map.remove(key));
+                times.sw += p.end();
+
+                p.start();
+                do_not_optimize(stl_map.erase(owned_key));
                 times.stl += p.end();
 
                 /*
@@ -261,13 +457,16 @@ void run_tests(
             }
 
             timings << end_range << ",remove,sc," << times.sc << "\n"
+                    << end_range << ",remove,scp," << times.scp << "\n"
                     << end_range << ",remove,lp," << times.lp << "\n"
                     << end_range << ",remove,qp," << times.qp << "\n"
                     << end_range << ",remove,dh," << times.dh << "\n"
+                    << end_range << ",remove,rh," << times.rh << "\n"
+                    << end_range << ",remove,sw," << times.sw << "\n"
                     << end_range << ",remove,stl," << times.stl << "\n";
 
             start_range = end_range;
-            times       = {0, 0, 0, 0, 0};
+            times       = {0, 0, 0, 0, 0, 0, 0, 0};
         }
 
         /*
@@ -290,38 +489,185 @@ void run_tests(
 
             for (int i = start_range; i < end_range; i++) {
                 const User *user = users[i];
-                const K key      = get_key_fn(user);
+                const auto key   = get_key_fn(user);
+                const K owned_key(key);
 
                 p.start();
-                sc_map.get(key);
+                do_not_optimize(sc_map.get(key));
                 times.sc += p.end();
 
                 p.start();
-                lp_map.get(key);
+                do_not_optimize(scp_map.get(key));
+                times.scp += p.end();
+
+                p.start();
+                do_not_optimize(lp_map.get(key));
                 times.lp += p.end();
 
                 p.start();
-                qp_map.get(key);
+                do_not_optimize(qp_map.get(key));
                 times.qp += p.end();
 
                 p.start();
-                dh_map.get(key);
+                do_not_optimize(dh_map.get(key));
                 times.dh += p.end();
 
                 p.start();
-                stl_map[key];
+                do_not_optimize(rh_map.get(key));
+                times.rh += p.end();
+
+                p.start();
+                do_not_optimize(sw_map.get(key));
+                times.sw += p.end();
+
+                p.start();
+                // unordered_map only has heterogeneous lookup since C++20
+                do_not_optimize(stl_map[owned_key]);
                 times.stl += p.end();
             }
 
             timings << end_range << ",get_(miss),sc," << times.sc << "\n"
+                    << end_range << ",get_(miss),scp," << times.scp << "\n"
                     << end_range << ",get_(miss),lp," << times.lp << "\n"
                     << end_range << ",get_(miss),qp," << times.qp << "\n"
                     << end_range << ",get_(miss),dh," << times.dh << "\n"
+                    << end_range << ",get_(miss),rh," << times.rh << "\n"
+                    << end_range << ",get_(miss),sw," << times.sw << "\n"
                     << end_range << ",get_(miss),stl," << times.stl << "\n";
 
             start_range = end_range;
-            times       = {0, 0, 0, 0, 0};
+            times       = {0, 0, 0, 0, 0, 0, 0, 0};
+        }
+
+        start_range = 0;
+        // map.get_batch(keys) (miss) tests, one call per range
+        for (int _ = 0; _ < ranges_amount; _++) {
+            const int end_range = min(start_range + TIMING_MEASURE_RANGE, users_size);
+            const int count     = end_range - start_range;
+
+            for (int i = start_range; i < end_range; i++)
+                batch_keys[i - start_range] = get_key_fn(users[i]);
+
+            p.start();
+            sc_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.sc += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            scp_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.scp += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            lp_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.lp += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            qp_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.qp += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            dh_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.dh += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            rh_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.rh += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            sw_impl.get_batch(batch_keys.data(), batch_values.data(), count);
+            times.sw += p.end();
+            do_not_optimize(batch_values.data());
+
+            p.start();
+            for (int i = 0; i < count; i++)
+                batch_values[i] = stl_map[K(batch_keys[i])];
+            times.stl += p.end();
+            do_not_optimize(batch_values.data());
+
+            timings << end_range << ",get_batch_(miss),sc," << times.sc << "\n"
+                    << end_range << ",get_batch_(miss),scp," << times.scp << "\n"
+                    << end_range << ",get_batch_(miss),lp," << times.lp << "\n"
+                    << end_range << ",get_batch_(miss),qp," << times.qp << "\n"
+                    << end_range << ",get_batch_(miss),dh," << times.dh << "\n"
+                    << end_range << ",get_batch_(miss),rh," << times.rh << "\n"
+                    << end_range << ",get_batch_(miss),sw," << times.sw << "\n"
+                    << end_range << ",get_batch_(miss),stl," << times.stl << "\n";
+
+            start_range = end_range;
+            times       = {0, 0, 0, 0, 0, 0, 0, 0};
+        }
+
+        start_range = 0;
+        // map.put_batch(keys, values) tests, one call per range
+        for (int _ = 0; _ < ranges_amount; _++) {
+            const int end_range = min(start_range + TIMING_MEASURE_RANGE, users_size);
+            const int count     = end_range - start_range;
+
+            for (int i = start_range; i < end_range; i++) {
+                batch_put_keys[i - start_range] = K(get_key_fn(users[i]));
+                batch_values[i - start_range]   = users[i];
+            }
+
+            p.start();
+            sc_impl.put_batch(batch_put_keys.data(), batch_values.data(), count);
+            times.sc += p.end();
+
+            p.start();
+            scp_impl.put_batch(batch_put_keys.data(), batch_values.data(), count);
+            times.scp += p.end();
+
+            p.start();
+            lp_impl.put_batch(batch_put_keys.data(), batch_values.data(), count);
+            times.lp += p.end();
+
+            p.start();
+            qp_impl.put_batch(batch_put_keys.data(), batch_values.data(), count);
+            times.qp += p.end();
+
+            p.start();
+            dh_impl.put_batch(batch_put_keys.data(), batch_values.data(), count);
+            times.dh += p.end();
+
+            p.start();
+            rh_impl.put_batch(batch_put_keys.data(), batch_values.data(), count);
+            times.rh += p.end();
+
+            p.start();
+            sw_impl.put_batch(batch_put_keys.data(), batch_values.data(), count);
+            times.sw += p.end();
+
+            p.start();
+            for (int i = 0; i < count; i++)
+                stl_map[batch_put_keys[i]] = batch_values[i];
+            times.stl += p.end();
+
+            timings << end_range << ",put_batch,sc," << times.sc << "\n"
+                    << end_range << ",put_batch,scp," << times.scp << "\n"
+                    << end_range << ",put_batch,lp," << times.lp << "\n"
+                    << end_range << ",put_batch,qp," << times.qp << "\n"
+                    << end_range << ",put_batch,dh," << times.dh << "\n"
+                    << end_range << ",put_batch,rh," << times.rh << "\n"
+                    << end_range << ",put_batch,sw," << times.sw << "\n"
+                    << end_range << ",put_batch,stl," << times.stl << "\n";
+
+            start_range = end_range;
+            times       = {0, 0, 0, 0, 0, 0, 0, 0};
         }
+
+        // Leave the maps empty for the next test, like the remove tests do
+        sc_impl.clear();
+        scp_impl.clear();
+        lp_impl.clear();
+        qp_impl.clear();
+        dh_impl.clear();
+        rh_impl.clear();
+        sw_impl.clear();
+        stl_map.clear();
     }
 
     cout << "total time: " << total.end<performance::milliseconds>() / 1e3 << " s\n"
@@ -335,3 +681,651 @@ void run_tests(
 
     cout << "saved\n\n" << results.rdbuf() << endl;
 }
+
+/** Insert every user through `put`, recording the latency of each call */
+template <typename K, typename Put>
+void measure_put_latencies(
+    const user_list &users,
+    function<K(const User *)> &get_key_fn,
+    Put put,
+    vector<uint64> &latencies
+) {
+    performance p;
+
+    for (const User *user : users) {
+        const K key = get_key_fn(user);
+
+        p.start();
+        do_not_optimize(put(key, user));
+        latencies.push_back(p.end());
+    }
+}
+
+/** Print the p50, p99, p999 and max of a set of latencies */
+inline void put_latency_info(stringstream &out, const string &map_name, vector<uint64> &latencies) {
+    sort(latencies.begin(), latencies.end());
+
+    auto percentile = [&latencies](double p) {
+        return latencies[min((size_t)(p * latencies.size()), latencies.size() - 1)] / 1e3;
+    };
+
+    out << "[" << map_name << "] put latency: "
+        << "p50 " << percentile(0.5) << " μs, "
+        << "p99 " << percentile(0.99) << " μs, "
+        << "p999 " << percentile(0.999) << " μs, "
+        << "max " << latencies.back() / 1e3 << " μs\n";
+}
+
+/**
+ * Measure the tail latency of map.put(k, v) while the maps grow from LATENCY_INITIAL_SIZE
+ * Stop-the-world resizes show up in p99/p999, sci is the sc map resizing incrementally
+ * Results are only printed, they don't fit the timing data format
+ */
+template <typename K, typename Capacity = prime_capacity, typename ScHash, typename LHash, typename DhHash>
+void run_put_latency_tests(
+    string name,
+    const int tests,
+    const user_list &users,
+    function<K(const User *)> get_key_fn,
+    ScHash sc_hash_fn,
+    LHash l_hash_fn,
+    DhHash dh_hash_fn
+) {
+    cout << "\n==========================================================\n\n"
+         << "running " << tests << "x " << name << " put latency tests...\n"
+         << endl;
+
+    vector<uint64> sc, sci, lp, qp, dh, rh, sw, stl;
+
+    for (int n_test = 0; n_test < tests; n_test++) {
+        sc_hash_map<K, const User *, Capacity, ScHash> sc_map(LATENCY_INITIAL_SIZE, sc_hash_fn);
+        sc_hash_map<K, const User *, Capacity, ScHash> sci_map(LATENCY_INITIAL_SIZE, sc_hash_fn, true);
+        lp_hash_map<K, const User *, Capacity, LHash> lp_map(LATENCY_INITIAL_SIZE, l_hash_fn);
+        qp_hash_map<K, const User *, Capacity, LHash> qp_map(LATENCY_INITIAL_SIZE, l_hash_fn);
+        dh_hash_map<K, const User *, Capacity, LHash, DhHash> dh_map(LATENCY_INITIAL_SIZE, l_hash_fn, dh_hash_fn);
+        rh_hash_map<K, const User *, Capacity, LHash> rh_map(LATENCY_INITIAL_SIZE, l_hash_fn);
+        sw_hash_map<K, const User *, LHash> sw_map(LATENCY_INITIAL_SIZE, l_hash_fn);
+        unordered_map<K, const User *, ScHash> stl_map(LATENCY_INITIAL_SIZE, sc_hash_fn);
+
+        measure_put_latencies(
+            users, get_key_fn, [&](const K &key, const User *user) { return sc_map.put(key, user); }, sc
+        );
+        measure_put_latencies(
+            users, get_key_fn, [&](const K &key, const User *user) { return sci_map.put(key, user); }, sci
+        );
+        measure_put_latencies(
+            users, get_key_fn, [&](const K &key, const User *user) { return lp_map.put(key, user); }, lp
+        );
+        measure_put_latencies(
+            users, get_key_fn, [&](const K &key, const User *user) { return qp_map.put(key, user); }, qp
+        );
+        measure_put_latencies(
+            users, get_key_fn, [&](const K &key, const User *user) { return dh_map.put(key, user); }, dh
+        );
+        measure_put_latencies(
+            users, get_key_fn, [&](const K &key, const User *user) { return rh_map.put(key, user); }, rh
+        );
+        measure_put_latencies(
+            users, get_key_fn, [&](const K &key, const User *user) { return sw_map.put(key, user); }, sw
+        );
+        measure_put_latencies(
+            users, get_key_fn, [&](const K &key, const User *user) { return stl_map[key] = user; }, stl
+        );
+    }
+
+    stringstream results;
+    put_latency_info(results, "sc", sc);
+    put_latency_info(results, "sci", sci);
+    put_latency_info(results, "lp", lp);
+    put_latency_info(results, "qp", qp);
+    put_latency_info(results, "dh", dh);
+    put_latency_info(results, "rh", rh);
+    put_latency_info(results, "sw", sw);
+    put_latency_info(results, "stl", stl);
+
+    cout << "\n" << results.rdbuf() << endl;
+}
+
+/** Share of the operations of the concurrent tests that are writes, one in WRITE_INTERVAL */
+const int WRITE_INTERVAL = 20;
+
+/**
+ * Run `threads` threads that go through every key `passes` times, each starting at a different offset,
+ * and return the throughput in operations per microsecond (millions per second)
+ * One in WRITE_INTERVAL operations is `put(index)`, the rest are `get(index)`
+ */
+template <typename Get, typename Put>
+double measure_throughput(const int threads, const int passes, const int keys_size, Get get, Put put) {
+    vector<thread> workers;
+    performance p;
+    p.start();
+
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            const int offset = (uint64)keys_size * t / threads;
+
+            for (int pass = 0; pass < passes; pass++) {
+                for (int i = 0; i < keys_size; i++) {
+                    const int index = (offset + i) % keys_size;
+
+                    if (i % WRITE_INTERVAL == 0) {
+                        do_not_optimize(put(index));
+                    } else {
+                        do_not_optimize(get(index));
+                    }
+                }
+            }
+        });
+    }
+
+    for (thread &worker : workers)
+        worker.join();
+
+    return (double)threads * passes * keys_size / p.end<performance::microseconds>();
+}
+
+/**
+ * Measure how the throughput of a read-heavy workload scales from 1 thread up to the amount of cores
+ * cc is the sharded map made of lp maps, lf the map with lock-free reads,
+ * mutex is a single lp map behind one global lock
+ * Results are only printed, they don't fit the timing data format
+ */
+template <typename K, int N, typename KeyFn, typename Hash>
+void run_concurrent_tests(
+    string name,
+    const int tests,
+    const user_list &users,
+    KeyFn get_key_fn,
+    Hash hash_fn
+) {
+    typedef lp_hash_map<K, const User *, prime_capacity, Hash, equal_to<>> lp_map_t;
+
+    const int max_threads = max(thread::hardware_concurrency(), 1u);
+
+    cout << "\n==========================================================\n\n"
+         << "running " << tests << "x " << name << " concurrent tests with up to " << max_threads << " threads...\n"
+         << endl;
+
+    const int users_size = users.size();
+
+    vector<decay_t<invoke_result_t<KeyFn, const User *>>> keys;
+    vector<K> put_keys;
+    for (const User *user : users) {
+        keys.push_back(get_key_fn(user));
+        put_keys.push_back(K(keys.back()));
+    }
+
+    cc_hash_map<K, const User *, lp_map_t, Hash> cc_map(N, hash_fn);
+    lf_hash_map<K, const User *, prime_capacity, Hash, equal_to<>> lf_map(N, hash_fn);
+    lp_map_t mutex_map(N, hash_fn);
+    mutex global_lock;
+
+    for (int i = 0; i < users_size; i++) {
+        cc_map.put(put_keys[i], users[i]);
+        lf_map.put(put_keys[i], users[i]);
+        mutex_map.put(put_keys[i], users[i]);
+    }
+
+    stringstream results;
+
+    // 1, 2, 4... threads, up to the amount of cores
+    for (int threads = 1;; threads = min(threads * 2, max_threads)) {
+        const double cc = measure_throughput(
+            threads,
+            tests,
+            users_size,
+            [&](int i) { return cc_map.get(keys[i]); },
+            [&](int i) { return cc_map.put(put_keys[i], users[i]); }
+        );
+
+        const double lf = measure_throughput(
+            threads,
+            tests,
+            users_size,
+            [&](int i) { return lf_map.get(keys[i]); },
+            [&](int i) { return lf_map.put(put_keys[i], users[i]); }
+        );
+
+        const double global = measure_throughput(
+            threads,
+            tests,
+            users_size,
+            [&](int i) {
+                lock_guard<mutex> lock(global_lock);
+                return mutex_map.get(keys[i]);
+            },
+            [&](int i) {
+                lock_guard<mutex> lock(global_lock);
+                return mutex_map.put(put_keys[i], users[i]);
+            }
+        );
+
+        results << "[" << threads << " threads] cc: " << cc << " Mops/s, lf: " << lf << " Mops/s, mutex: " << global
+                << " Mops/s\n";
+
+        if (threads == max_threads)
+            break;
+    }
+
+    cc_map.info(results);
+    lf_map.info(results);
+    cout << results.rdbuf() << endl;
+}
+
+/**
+ * Measure how long filling an lp map with every user takes, one put at a time into a table already sized for all
+ * of them vs build_from with 1, 2, 4... threads, up to the amount of cores
+ * Results are only printed, they don't fit the timing data format
+ */
+template <typename K, typename KeyFn, typename Hash>
+void run_build_tests(
+    string name,
+    const int tests,
+    const user_list &users,
+    KeyFn get_key_fn,
+    Hash hash_fn
+) {
+    typedef lp_hash_map<K, const User *, prime_capacity, Hash, equal_to<>> lp_map_t;
+
+    const int max_threads = max(thread::hardware_concurrency(), 1u);
+
+    cout << "\n==========================================================\n\n"
+         << "running " << tests << "x " << name << " build tests with up to " << max_threads << " threads...\n"
+         << endl;
+
+    performance p;
+    stringstream results;
+    uint64 put_time = 0;
+
+    for (int n_test = 0; n_test < tests; n_test++) {
+        p.start();
+
+        // Sized so the load factor threshold (0.75) is never reached
+        lp_map_t lp_map(users.size() * 4 / 3 + 1, hash_fn);
+        for (const User *user : users)
+            lp_map.put(K(get_key_fn(user)), user);
+
+        put_time += p.end();
+        do_not_optimize(lp_map.size());
+    }
+
+    results << "[put] " << put_time / tests / 1e6 << " ms\n";
+
+    // 1, 2, 4... threads, up to the amount of cores
+    for (int threads = 1;; threads = min(threads * 2, max_threads)) {
+        uint64 build_time = 0;
+
+        for (int n_test = 0; n_test < tests; n_test++) {
+            p.start();
+            lp_map_t lp_map(users, get_key_fn, hash_fn, threads);
+            build_time += p.end();
+            do_not_optimize(lp_map.size());
+        }
+
+        results << "[build_from, " << threads << " threads] " << build_time / tests / 1e6 << " ms\n";
+
+        if (threads == max_threads)
+            break;
+    }
+
+    cout << results.rdbuf() << endl;
+}
+
+/** Average time in nanoseconds of `get(key)` over every key */
+template <typename Key, typename Get> double measure_get(const vector<Key> &keys, Get get) {
+    performance p;
+    p.start();
+
+    for (const Key &key : keys)
+        do_not_optimize(get(key));
+
+    return (double)p.end() / max(keys.size(), (size_t)1);
+}
+
+/**
+ * Compare the frozen map with lp and stl, built once from every other user
+ * The rest of the users are looked up as misses
+ * Results are only printed, they don't fit the timing data format
+ */
+template <typename K, typename KeyFn, typename Hash>
+void run_frozen_tests(
+    string name,
+    const int tests,
+    const user_list &users,
+    KeyFn get_key_fn,
+    Hash hash_fn
+) {
+    cout << "\n==========================================================\n\n"
+         << "running " << tests << "x " << name << " frozen map tests...\n"
+         << endl;
+
+    vector<const User *> stored;
+    vector<decay_t<invoke_result_t<KeyFn, const User *>>> hits, misses;
+
+    for (uint32 i = 0; i < users.size(); i++) {
+        if (i % 2 == 0) {
+            stored.push_back(users[i]);
+            hits.push_back(get_key_fn(users[i]));
+        } else {
+            misses.push_back(get_key_fn(users[i]));
+        }
+    }
+
+    performance p;
+    double frozen_build = 0, lp_build = 0, stl_build = 0;
+    double frozen_hit = 0, lp_hit = 0, stl_hit = 0;
+    double frozen_miss = 0, lp_miss = 0, stl_miss = 0;
+    stringstream results;
+
+    for (int n_test = 0; n_test < tests; n_test++) {
+        p.start();
+        frozen_map<K, const User *, frozen_hash, equal_to<>> frozen(stored, get_key_fn);
+        frozen_build += p.end();
+
+        p.start();
+        lp_hash_map<K, const User *, prime_capacity, Hash, equal_to<>> lp_map(stored, get_key_fn, hash_fn, 1);
+        lp_build += p.end();
+
+        p.start();
+        unordered_map<K, const User *> stl_map(stored.size());
+        for (const User *user : stored)
+            stl_map[K(get_key_fn(user))] = user;
+        stl_build += p.end();
+
+        // unordered_map only has heterogeneous lookup since C++20
+        const auto stl_get = [&](const auto &key) {
+            const auto found = stl_map.find(K(key));
+            return found != stl_map.end() ? found->second : nullptr;
+        };
+
+        frozen_hit  += measure_get(hits, [&](const auto &key) { return frozen.get(key); });
+        lp_hit      += measure_get(hits, [&](const auto &key) { return lp_map.get(key); });
+        stl_hit     += measure_get(hits, stl_get);
+        frozen_miss += measure_get(misses, [&](const auto &key) { return frozen.get(key); });
+        lp_miss     += measure_get(misses, [&](const auto &key) { return lp_map.get(key); });
+        stl_miss    += measure_get(misses, stl_get);
+
+        if (n_test == tests - 1)
+            frozen.info(results);
+    }
+
+    cout << "[frozen] build: " << frozen_build / tests / 1e6 << " ms, get (hit): " << frozen_hit / tests
+         << " ns, get (miss): " << frozen_miss / tests << " ns\n"
+         << "[lp] build: " << lp_build / tests / 1e6 << " ms, get (hit): " << lp_hit / tests
+         << " ns, get (miss): " << lp_miss / tests << " ns\n"
+         << "[stl] build: " << stl_build / tests / 1e6 << " ms, get (hit): " << stl_hit / tests
+         << " ns, get (miss): " << stl_miss / tests << " ns\n\n"
+         << results.rdbuf() << endl;
+}
+
+/**
+ * Measure the throughput of hash functions on their own, hashing the key of every user
+ * Each hash is a `{name, hash_fn}` pair, printed with its time per key and the bytes of key it reads per second
+ */
+template <typename KeyFn, typename... Hashes>
+void run_hash_tests(
+    string name,
+    const int tests,
+    const user_list &users,
+    KeyFn get_key_fn,
+    pair<const char *, Hashes>... hashes
+) {
+    cout << "\n==========================================================\n\n"
+         << "running " << tests << "x " << name << " hash tests...\n"
+         << endl;
+
+    typedef decay_t<invoke_result_t<KeyFn, const User *>> key_t;
+
+    vector<key_t> keys;
+    uint64 bytes = 0;
+
+    for (const User *user : users) {
+        keys.push_back(get_key_fn(user));
+
+        if constexpr (is_arithmetic<key_t>::value)
+            bytes += sizeof(key_t);
+        else
+            bytes += keys.back().size();
+    }
+
+    performance p;
+    stringstream results;
+
+    const auto measure = [&](const char *hash_name, auto hash_fn) {
+        uint64 time = 0;
+
+        for (int n_test = 0; n_test < tests; n_test++) {
+            p.start();
+
+            for (const key_t &key : keys)
+                do_not_optimize(hash_fn(key));
+
+            time += p.end();
+        }
+
+        const double ns = (double)time / tests;
+        results << "[" << hash_name << "] " << ns / max(keys.size(), (size_t)1) << " ns/key, " << bytes / ns
+                << " GB/s\n";
+    };
+
+    (measure(hashes.first, hashes.second), ...);
+
+    cout << results.rdbuf() << endl;
+}
+
+/** Timestamp parsing read_csv used to do, through a stream and libc, kept as the reference for string_to_time */
+time_t stream_string_to_time(const string &field) {
+    istringstream input(field);
+    tm result;
+    input >> get_time(&result, "%a %b %d %H:%M:%S +0000 %Y");
+    return timegm(&result);
+}
+
+/** Compare string_to_time against the stream based parsing over every created_at value of the CSV */
+void run_timestamp_tests(const char *file_name, const int tests) {
+    cout << "\n==========================================================\n\n"
+         << "running " << tests << "x timestamp tests...\n"
+         << endl;
+
+    const mapped_file csv(file_name);
+    csv_tokenizer rows(csv.data(), csv.data() + csv.size());
+    string_view fields[7];
+
+    // remove first line
+    rows.next_row(fields, 7);
+
+    vector<string_view> timestamps;
+    while (const uint32 found = rows.next_row(fields, 7))
+        if (found == 7)
+            timestamps.push_back(fields[6]);
+
+    uint32 mismatches = 0;
+    for (string_view timestamp : timestamps)
+        mismatches += string_to_time(timestamp) != stream_string_to_time(string(timestamp));
+
+    performance p;
+    uint64 stream_time = 0, fixed_time = 0;
+
+    for (int n_test = 0; n_test < tests; n_test++) {
+        p.start();
+        for (string_view timestamp : timestamps)
+            do_not_optimize(stream_string_to_time(string(timestamp)));
+        stream_time += p.end();
+
+        p.start();
+        for (string_view timestamp : timestamps)
+            do_not_optimize(string_to_time(timestamp));
+        fixed_time += p.end();
+    }
+
+    const double count = (double)tests * max(timestamps.size(), (size_t)1);
+
+    cout << "timestamps: " << timestamps.size() << " (" << mismatches << " parsed differently)\n"
+         << "[istringstream + get_time + timegm] " << stream_time / count << " ns per timestamp\n"
+         << "[string_to_time] " << fixed_time / count << " ns per timestamp\n"
+         << endl;
+}
+
+/** Amount of keys put in the tiny table tests, enough to go through a few resizes */
+const int TINY_TABLE_KEYS = 64;
+
+/**
+ * Hash that sends every key to a handful of slots, so tiny tables fill up and probes wrap around
+ * Negative, the maps have to reduce it to the same unsigned hash on every path
+ */
+inline int clustered_hash(const uint64 &key) {
+    return -(int)(key % 3) - 1;
+}
+
+/**
+ * Put, get, miss and remove keys on `map`, comparing every result with an unordered_map
+ * Exits on the first difference
+ */
+template <typename M>
+void check_tiny_map(const char *map_name, uint32 initial_size, M &map, const user_list &users) {
+    unordered_map<uint64, const User *> expected;
+    const uint32 count = min(users.size(), (size_t)TINY_TABLE_KEYS);
+
+    const auto fail = [&](const char *operation, uint64 key) {
+        cerr << "[" << map_name << "] initial size " << initial_size << ": " << operation << "(" << key
+             << ") differs from unordered_map." << endl;
+        exit(1);
+    };
+
+    // Odd keys are put, even ones are misses
+    for (uint32 i = 0; i < count; i++) {
+        const uint64 key = 2 * i + 1;
+
+        if (map.get(key + 1) != nullptr)
+            fail("get", key + 1);
+        if (map.put(key, users[i]) != nullptr)
+            fail("put", key);
+
+        expected[key] = users[i];
+
+        for (const auto &[stored, user] : expected)
+            if (map.get(stored) != user)
+                fail("get", stored);
+    }
+
+    for (uint32 i = 0; i < count; i += 2) {
+        const uint64 key = 2 * i + 1;
+
+        if (map.remove(key) != expected[key])
+            fail("remove", key);
+
+        expected.erase(key);
+    }
+
+    for (uint64 key = 0; key <= 2 * count; key++) {
+        const auto found = expected.find(key);
+        if (map.get(key) != (found != expected.end() ? found->second : nullptr))
+            fail("get", key);
+    }
+
+    if (map.size() != expected.size())
+        fail("size", 0);
+}
+
+/** Every map starting from tables of 0 to 4 slots, sizes that doubling can round back to */
+template <typename Capacity> void check_tiny_maps(const user_list &users) {
+    typedef static_hash<clustered_hash> Hash;
+
+    for (uint32 initial_size = 0; initial_size <= 4; initial_size++) {
+        sc_hash_map<uint64, const User *, Capacity, Hash> sc_map(initial_size);
+        check_tiny_map("sc", initial_size, sc_map, users);
+
+        lp_hash_map<uint64, const User *, Capacity, Hash> lp_map(initial_size);
+        check_tiny_map("lp", initial_size, lp_map, users);
+
+        qp_hash_map<uint64, const User *, Capacity, Hash> qp_map(initial_size);
+        check_tiny_map("qp", initial_size, qp_map, users);
+
+        dh_hash_map<uint64, const User *, Capacity, Hash, Hash> dh_map(initial_size);
+        check_tiny_map("dh", initial_size, dh_map, users);
+
+        rh_hash_map<uint64, const User *, Capacity, Hash> rh_map(initial_size);
+        check_tiny_map("rh", initial_size, rh_map, users);
+
+        sw_hash_map<uint64, const User *, Hash> sw_map(initial_size);
+        check_tiny_map("sw", initial_size, sw_map, users);
+    }
+}
+
+/**
+ * Check every map against unordered_map when it starts out tiny
+ * Tables of a few slots are where rounding the size up can keep a table from growing, and a full table would
+ * make a probe for a missing key run forever
+ */
+void run_tiny_table_tests(const user_list &users) {
+    cout << "\n==========================================================\n\n"
+         << "running tiny table tests...\n"
+         << endl;
+
+    check_tiny_maps<prime_capacity>(users);
+    check_tiny_maps<pow2_capacity>(users);
+
+    cout << "\nevery map matches unordered_map from initial sizes 0 to 4\n" << endl;
+}
+
+/**
+ * Check that read_csv never merges users with an ambiguous id (see parse_id) into users with an exact one
+ * Two users share an ambiguous id, and exact users hold the first two ids of its range: the ambiguous users have
+ * to move past them and keep their own rows
+ */
+void run_ambiguous_id_tests() {
+    cout << "\n==========================================================\n\n"
+         << "running ambiguous id tests...\n"
+         << endl;
+
+    // Outside data/, which only holds timing results
+    const string file_name = (filesystem::temp_directory_path() / "ambiguous_ids.csv").string();
+    const char *created    = "Wed Jul 27 02:05:45 +0000 2011";
+
+    ofstream csv(file_name);
+    csv << "University,User ID,User Name,Number Tweets,Friends Count,Followers Count,Created At\n"
+        << "uni_a,7.58561835897479E+017,ambiguous_a,1,1,1," << created << "\n"
+        << "uni_b,7.58561835897479E+017,ambiguous_b,2,2,2," << created << "\n"
+        << "uni_c,758561835897479001,exact_c,3,3,3," << created << "\n"
+        << "uni_d,7.58561835897479E+017,ambiguous_a,4,4,4," << created << "\n"
+        << "uni_e,758561835897479000,exact_e,5,5,5," << created << "\n";
+    csv.close();
+
+    csv_stats stats;
+    const vector<const User *> users = read_csv(file_name.c_str(), 1, &stats);
+    filesystem::remove(file_name);
+
+    // username -> id, followers, universities
+    const unordered_map<string, tuple<uint64, uint32, string>> expected = {
+        {"exact_e", {758561835897479000ull, 5, "uni_e"}},
+        {"exact_c", {758561835897479001ull, 3, "uni_c"}},
+        {"ambiguous_a", {758561835897479002ull, 4, "uni_a, uni_d"}},
+        {"ambiguous_b", {758561835897479003ull, 2, "uni_b"}},
+    };
+
+    bool passed = users.size() == expected.size() && stats.split_users == 2 && stats.duplicate_ids == 0;
+
+    for (const User *user : users) {
+        const auto found = expected.find(user->username);
+        if (found == expected.end()) {
+            passed = false;
+            continue;
+        }
+
+        const auto &[id, followers, universities] = found->second;
+        const string text                         = user->to_string();
+
+        passed = passed && user->id == id && user->followers == followers
+              && text.compare(text.size() - universities.size(), universities.size(), universities) == 0;
+    }
+
+    for (const User *user : users)
+        delete user;
+
+    if (!passed) {
+        cerr << "read_csv merged or misplaced users with ambiguous ids read from " << file_name << "." << endl;
+        exit(1);
+    }
+
+    cout << "\nambiguous users kept apart from the exact ids of their range\n" << endl;
+}
@@ -1,15 +1,44 @@
 #pragma once
 
+#include <cstddef>
 #include <cstring>
 #include <ctime>
+#include <iterator>
 #include <sstream>
 #include <string>
+#include <vector>
 
+typedef unsigned char uint8;
+typedef unsigned short uint16;
 typedef unsigned int uint32;
 typedef unsigned long long uint64;
 
 using namespace std;
 
+/** Powers of ten that fit in an uint64 */
+constexpr const uint64 POWERS_OF_10[] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+    100000000000000000ull,
+    1000000000000000000ull,
+    10000000000000000000ull,
+};
+
 /** Transform timestamp value into a human-readable string */
 string timestamp_to_string(time_t timestamp) {
     tm *time = gmtime(&timestamp);
@@ -26,6 +55,13 @@ class User {
     static const int MAX_USERNAME_LEN = 16;
     static const int MAX_UNIVERSITIES = 11;
 
+    /** Copy up to MAX_USERNAME_LEN - 1 characters of `source` into `dest`, zero padded */
+    static void copy_name(char *dest, const char *source) {
+        const size_t length = strnlen(source, MAX_USERNAME_LEN - 1);
+        memcpy(dest, source, length);
+        memset(dest + length, 0, MAX_USERNAME_LEN - length);
+    }
+
   public:
     /** The id */
     uint64 id;
@@ -37,6 +73,11 @@ class User {
     uint32 friends;
     /** Followers count */
     uint32 followers;
+    /**
+     * Whether the id was written in scientific notation that dropped some of its digits (see parse_id)
+     * The real id is one of the ids the notation stands for, the stored one is the first of them no other user has
+     */
+    bool ambiguous_id;
     /**
      * Time the user was created at
      * Stored as time_t (int64) to reduce the used space
@@ -47,14 +88,19 @@ class User {
 
     /** Constructor that takes most of the key information */
     User(uint64 id, const char *username, uint32 tweets, uint32 friends, uint32 followers, time_t created_at)
-        : id(id), tweets(tweets), friends(friends), followers(followers), created_at(created_at) {
-        strncpy(this->username, username, MAX_USERNAME_LEN);
-        this->username[MAX_USERNAME_LEN - 1] = 0;
+        : id(id), tweets(tweets), friends(friends), followers(followers), ambiguous_id(false),
+          created_at(created_at) {
+        copy_name(this->username, username);
 
         for (int i = 0; i < MAX_UNIVERSITIES; i++)
             this->universities[i][0] = 0;
     }
 
+    /** Whether the user has `username`, compared up to the length usernames are stored with */
+    bool has_username(const char *username) const {
+        return strncmp(this->username, username, MAX_USERNAME_LEN - 1) == 0;
+    }
+
     /**
      * Assuming the provided data wasn't all collected at the exact same time,
      * stats must be updated as the entires at the end of the file would be the newest
@@ -75,13 +121,23 @@ class User {
                 return;
 
             if (this->universities[i][0] == 0) {
-                strncpy(this->universities[i], university, MAX_USERNAME_LEN);
-                this->universities[i][MAX_USERNAME_LEN - 1] = 0;
+                copy_name(this->universities[i], university);
                 return;
             }
         }
     }
 
+    /**
+     * Fold in a later copy of the same user, read from rows further down the file
+     * Its stats are the newest ones, and its universities are added after the already known ones
+     */
+    void merge(const User &later) {
+        this->update_stats(later.tweets, later.friends, later.followers);
+
+        for (int i = 0; i < MAX_UNIVERSITIES && later.universities[i][0] != 0; i++)
+            this->add_university(later.universities[i]);
+    }
+
     /** Builds a string with all the information of this user */
     string to_string() const {
         ostringstream oss;
@@ -104,3 +160,115 @@ class User {
         return oss.str();
     }
 };
+
+/**
+ * Read-only list of users that doesn't own them
+ * Views either an array of pointers to users (what read_csv returns) or an array of the users themselves
+ * (the records of a snapshot), both read as `const User *`
+ */
+class user_list {
+  private:
+    /** Pointers to the users, null when viewing records */
+    const User *const *pointers = nullptr;
+    /** The users themselves, null when viewing pointers */
+    const User *records = nullptr;
+    /** Amount of users */
+    size_t count = 0;
+
+  public:
+    class iterator;
+
+    user_list() {}
+
+    /** View of the users pointed to by `users`, which has to outlive the list */
+    user_list(const vector<const User *> &users) : pointers(users.data()), count(users.size()) {}
+
+    /** View of `count` users stored one after the other */
+    user_list(const User *records, size_t count) : records(records), count(count) {}
+
+    /** User at `index` */
+    inline const User *operator[](size_t index) const {
+        return this->pointers != nullptr ? this->pointers[index] : this->records + index;
+    }
+
+    /** Amount of users */
+    size_t size() const {
+        return this->count;
+    }
+
+    iterator begin() const;
+
+    iterator end() const;
+};
+
+/** Random access iterator over a user_list, dereferences to `const User *` */
+class user_list::iterator {
+  private:
+    /** Copy of the list, so the iterator stays valid after a temporary list is gone */
+    user_list list;
+    ptrdiff_t index;
+
+  public:
+    typedef random_access_iterator_tag iterator_category;
+    typedef const User *value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const User *const *pointer;
+    typedef const User *reference;
+
+    iterator(const user_list &list, ptrdiff_t index) : list(list), index(index) {}
+
+    const User *operator*() const {
+        return this->list[this->index];
+    }
+
+    const User *operator[](ptrdiff_t offset) const {
+        return this->list[this->index + offset];
+    }
+
+    iterator &operator++() {
+        this->index++;
+        return *this;
+    }
+
+    iterator &operator--() {
+        this->index--;
+        return *this;
+    }
+
+    iterator &operator+=(ptrdiff_t offset) {
+        this->index += offset;
+        return *this;
+    }
+
+    iterator operator+(ptrdiff_t offset) const {
+        return iterator(this->list, this->index + offset);
+    }
+
+    iterator operator-(ptrdiff_t offset) const {
+        return iterator(this->list, this->index - offset);
+    }
+
+    ptrdiff_t operator-(const iterator &other) const {
+        return this->index - other.index;
+    }
+
+    bool operator==(const iterator &other) const {
+        return this->index == other.index;
+    }
+
+    bool operator!=(const iterator &other) const {
+        return this->index != other.index;
+    }
+
+    bool operator<(const iterator &other) const {
+        return this->index < other.index;
+    }
+};
+
+inline user_list::iterator user_list::begin() const {
+    return iterator(*this, 0);
+}
+
+inline user_list::iterator user_list::end() const {
+    return iterator(*this, this->count);
+}